@@ -0,0 +1,283 @@
+/*
+ * bench-trans.c - Time the registered transpose functions on real hardware
+ *
+ * test-trans judges a transpose by its misses on a simulated 1KB cache;
+ * this measures wall-clock time on the machine's own caches instead, on
+ * matrices up to 8192x8192. trans.c is compiled at -O2 for it.
+ *
+ * Each function is checked once for correctness, run warmup times, then
+ * timed the way CS:APP's fcyc times code: samples are taken until the K
+ * fastest agree within a tolerance or the repetition limit is hit, and the
+ * fastest is reported along with the median and p99 of all samples.
+ * trans.c's AVX2 kernel is registered like the others and serves as the
+ * baseline.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime and posix_memalign
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "cachelab.h"
+
+#define MAX_SIZES 16
+#define MAX_REPS 1000
+#define OVERRUN 32 // rows and columns of slack for functions that assume a multiple of their block
+
+/* External function defined in trans.c */
+extern void registerFunctions();
+
+/* External variables defined in cachelab.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+/* Timing of one function on one matrix size */
+struct bench_result
+{
+    double best;   // fcyc time: fastest sample once the K best agree, seconds
+    double median;
+    double p99;
+    int samples;
+    int converged; // the K best agreed before the repetition limit
+};
+
+/* Command line settings */
+static int warmup = 1;       // untimed runs before sampling
+static int max_reps = 10;    // most samples per function and size
+static int kbest = 3;        // samples that must agree
+static double epsilon = 0.01; // relative spread allowed among the K best
+
+static void print_help(void);
+static int parse_sizes(char *spec, int sizes[][2]);
+static void bench_size(int M, int N, int only_func);
+static int run_bench(void (*func)(int M, int N, int A[N][M], int B[M][N]),
+                     int M, int N, int *A, int *B, struct bench_result *res);
+static double time_once(void (*func)(int M, int N, int A[N][M], int B[M][N]),
+                        int M, int N, int *A, int *B);
+static int cmp_double(const void *a, const void *b);
+
+int main(int argc, char *argv[])
+{
+    char default_sizes[] = "256,1024,4096,8192";
+    char *size_spec = default_sizes;
+    int sizes[MAX_SIZES][2];
+    int only_func = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:w:r:k:e:F:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            size_spec = optarg;
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'r':
+            max_reps = atoi(optarg);
+            break;
+        case 'k':
+            kbest = atoi(optarg);
+            break;
+        case 'e':
+            epsilon = atof(optarg);
+            break;
+        case 'F':
+            only_func = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_help();
+            exit(1);
+        }
+    }
+    if (warmup < 0 || max_reps < 1 || max_reps > MAX_REPS || kbest < 1 || kbest > max_reps ||
+        epsilon < 0)
+    {
+        printf("Need -w >= 0, 1 <= -k <= -r <= %d and -e >= 0\n", MAX_REPS);
+        exit(1);
+    }
+
+    int num_sizes = parse_sizes(size_spec, sizes);
+    if (num_sizes < 0)
+    {
+        printf("Bad size list %s, expected sizes like 1024 or 61x67 separated by commas\n",
+               size_spec);
+        exit(1);
+    }
+
+    registerFunctions();
+    if (only_func >= func_counter)
+    {
+        printf("There are only %d registered functions\n", func_counter);
+        exit(1);
+    }
+
+    for (int i = 0; i < num_sizes; i++)
+        bench_size(sizes[i][0], sizes[i][1], only_func);
+    return 0;
+}
+
+/*
+ * parse "<M>[x<N>],..." into sizes, a lone number being a square matrix;
+ * as in test-trans, A has N rows of M columns
+ * return the number of sizes, -1 for a bad list
+ */
+static int parse_sizes(char *spec, int sizes[][2])
+{
+    int n = 0;
+
+    for (char *p = spec; *p;)
+    {
+        char *end;
+        long M = strtol(p, &end, 10);
+        long N = M;
+
+        if (end == p || M <= 0 || n == MAX_SIZES)
+            return -1;
+        if (*end == 'x')
+        {
+            p = end + 1;
+            N = strtol(p, &end, 10);
+            if (end == p || N <= 0)
+                return -1;
+        }
+        if ((*end && *end != ',') || M > 65536 || N > 65536)
+            return -1;
+        sizes[n][0] = M;
+        sizes[n][1] = N;
+        n++;
+        p = *end ? end + 1 : end;
+    }
+    return n ? n : -1;
+}
+
+/*
+ * time every registered function on an N x M matrix
+ */
+static void bench_size(int M, int N, int only_func)
+{
+    size_t bytes = (size_t)M * N * sizeof(int);
+    size_t alloc = (size_t)(M + OVERRUN) * (N + OVERRUN) * sizeof(int);
+    int *A, *B;
+    struct bench_result res;
+    int unconverged = 0;
+
+    if (posix_memalign((void **)&A, 64, alloc) || posix_memalign((void **)&B, 64, alloc))
+    {
+        printf("Cannot allocate two %dx%d matrices\n", N, M);
+        exit(1);
+    }
+    initMatrix(M, N, (int (*)[M])A, (int (*)[N])B);
+
+    printf("\nM=%d N=%d, %.1f MB per matrix\n", M, N, bytes / 1e6);
+    printf("%-4s %-36s %10s %10s %10s %8s %8s\n",
+           "func", "description", "best us", "median us", "p99 us", "GB/s", "samples");
+
+    for (int i = 0; i < func_counter; i++)
+    {
+        if (only_func >= 0 && i != only_func)
+            continue;
+
+        if (run_bench(func_list[i].func_ptr, M, N, A, B, &res) < 0)
+        {
+            printf("%-4d %-36.36s %10s\n", i, func_list[i].description, "incorrect");
+            continue;
+        }
+        // a transpose reads and writes every element once
+        printf("%-4d %-36.36s %10.1f %10.1f %10.1f %8.2f %7d%s\n", i, func_list[i].description,
+               res.best * 1e6, res.median * 1e6, res.p99 * 1e6,
+               2.0 * bytes / res.best / 1e9, res.samples, res.converged ? "" : "*");
+        unconverged |= !res.converged;
+    }
+    if (unconverged)
+        printf("* the %d best samples did not agree within %.1f%%\n", kbest, epsilon * 100);
+
+    free(A);
+    free(B);
+}
+
+/*
+ * check func once, then sample it until the kbest fastest runs agree
+ * return -1 if it didn't transpose A correctly
+ */
+static int run_bench(void (*func)(int M, int N, int A[N][M], int B[M][N]),
+                     int M, int N, int *A, int *B, struct bench_result *res)
+{
+    double samples[MAX_REPS];
+    double sorted[MAX_REPS];
+    int n = 0;
+
+    memset(B, 0, (size_t)M * N * sizeof(int));
+    func(M, N, (int (*)[M])A, (int (*)[N])B);
+    for (size_t i = 0; i < (size_t)N; i++)
+    {
+        for (size_t j = 0; j < (size_t)M; j++)
+        {
+            if (A[i * M + j] != B[j * N + i])
+                return -1;
+        }
+    }
+
+    for (int i = 0; i < warmup; i++)
+        time_once(func, M, N, A, B);
+
+    res->converged = 0;
+    while (n < max_reps)
+    {
+        samples[n++] = time_once(func, M, N, A, B);
+        if (n < kbest)
+            continue;
+        memcpy(sorted, samples, n * sizeof(double));
+        qsort(sorted, n, sizeof(double), cmp_double);
+        if (sorted[kbest - 1] <= (1 + epsilon) * sorted[0])
+        {
+            res->converged = 1;
+            break;
+        }
+    }
+    memcpy(sorted, samples, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), cmp_double);
+
+    res->best = sorted[0];
+    res->median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    res->p99 = sorted[(99 * n + 99) / 100 - 1]; // nearest rank
+    res->samples = n;
+    return 0;
+}
+
+static double time_once(void (*func)(int M, int N, int A[N][M], int B[M][N]),
+                        int M, int N, int *A, int *B)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    func(M, N, (int (*)[M])A, (int (*)[N])B);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void print_help(void)
+{
+    printf("Usage: ./bench-trans [-h] [-n <sizes>] [-w <n>] [-r <n>] [-k <n>] [-e <eps>] [-F <func>]\n");
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -n <sizes>  Matrix sizes, N or MxN, comma separated (default %s).\n",
+           "256,1024,4096,8192");
+    printf("  -w <n>      Untimed warmup runs (default 1).\n");
+    printf("  -r <n>      Most timed runs per function and size (default 10).\n");
+    printf("  -k <n>      Stop once the n fastest runs agree (default 3).\n");
+    printf("  -e <eps>    Relative spread allowed among them (default 0.01).\n");
+    printf("  -F <func>   Only time registered function func.\n\n");
+    printf("Examples:\n");
+    printf("  linux>  ./bench-trans -n 1024,61x67 -r 50\n");
+}
@@ -0,0 +1,881 @@
+/*
+ * cache.c - The set-associative cache model shared by csim and libcsim
+ *
+ * Every function here reports bad input through its return value instead
+ * of exiting, so the model can be linked into other programs.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for strtok_r
+
+#include "cache.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+
+const struct tag_kernel tag_kernels[] = {
+    {"avx2", find_cline_avx2, has_avx2},
+    {"sse4.2", find_cline_sse42, has_sse42},
+    {"scalar", find_cline, NULL},
+};
+const int num_kernels = sizeof(tag_kernels) / sizeof(tag_kernels[0]);
+
+static void lru_touch(struct cache_sim *csim, __uint64_t ci, int line);
+static int oldest_victim(struct cache_sim *csim, __uint64_t ci);
+static void fifo_fill(struct cache_sim *csim, __uint64_t ci, int line);
+static void no_touch(struct cache_sim *csim, __uint64_t ci, int line);
+static int random_victim(struct cache_sim *csim, __uint64_t ci);
+static void seed_sets(struct cache_sim *csim);
+static void lfu_hit(struct cache_sim *csim, __uint64_t ci, int line);
+static void lfu_fill(struct cache_sim *csim, __uint64_t ci, int line);
+static void plru_touch(struct cache_sim *csim, __uint64_t ci, int line);
+static int plru_victim(struct cache_sim *csim, __uint64_t ci);
+static void bitplru_touch(struct cache_sim *csim, __uint64_t ci, int line);
+static int bitplru_victim(struct cache_sim *csim, __uint64_t ci);
+static void rrip_hit(struct cache_sim *csim, __uint64_t ci, int line);
+static void srrip_fill(struct cache_sim *csim, __uint64_t ci, int line);
+static void brrip_fill(struct cache_sim *csim, __uint64_t ci, int line);
+static int rrip_victim(struct cache_sim *csim, __uint64_t ci);
+
+const struct repl_policy repl_policies[] = {
+    {"lru", lru_touch, lru_touch, oldest_victim, NULL, 0},
+    {"fifo", no_touch, fifo_fill, oldest_victim, NULL, 0},
+    {"random", no_touch, no_touch, random_victim, seed_sets, 0},
+    {"lfu", lfu_hit, lfu_fill, oldest_victim, NULL, 0},
+    {"plru", plru_touch, plru_touch, plru_victim, NULL, 1},
+    {"bitplru", bitplru_touch, bitplru_touch, bitplru_victim, NULL, 0},
+    {"srrip", rrip_hit, srrip_fill, rrip_victim, NULL, 0},
+    {"brrip", rrip_hit, brrip_fill, rrip_victim, seed_sets, 0},
+};
+const int num_policies = sizeof(repl_policies) / sizeof(repl_policies[0]);
+
+// LRU, the default, is called directly on the hot paths so it can be inlined
+#define LRU_POLICY (&repl_policies[0])
+
+static void train_prefetcher(struct cache_sim *csim, __uint64_t addr, int line);
+static const struct prefetcher *find_prefetcher(const char *spec, int *degree);
+static void prefetch_block(struct cache_sim *csim, __uint64_t block);
+static void next_line_train(struct cache_sim *csim, __uint64_t addr, int miss);
+static void stride_train(struct cache_sim *csim, __uint64_t addr, int miss);
+static void stream_train(struct cache_sim *csim, __uint64_t addr, int miss);
+
+/* Prefetchers selectable with -p */
+static const struct prefetcher prefetchers[] = {
+    {"next", next_line_train, 1},
+    {"stride", stride_train, 1},
+    {"stream", stream_train, 2},
+};
+#define NUM_PREFETCHERS (int)(sizeof(prefetchers) / sizeof(prefetchers[0]))
+
+/*
+ * check that the named kernel and policy exist and can run E lines per set
+ * return -1 with the reason in err if they can't
+ */
+int check_policies(const char *kernel_name, const char *policy_name, int E,
+                   char *err, size_t err_len)
+{
+    const struct repl_policy *policy = pick_policy(policy_name);
+
+    if (!pick_kernel(kernel_name))
+    {
+        snprintf(err, err_len, "Unknown or unsupported tag-match kernel: %s", kernel_name);
+        return -1;
+    }
+    if (!policy)
+    {
+        snprintf(err, err_len, "Unknown replacement policy: %s", policy_name);
+        return -1;
+    }
+    if (policy->pow2_only && (E & (E - 1)))
+    {
+        snprintf(err, err_len, "Replacement policy %s needs E to be a power of two", policy->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * allocate the lines and policy state of all S sets in one slab, every line empty
+ * return -1 with the reason in err if the configuration can't be built
+ */
+int alloc_cache(struct cache_sim *csim, char *err, size_t err_len)
+{
+    size_t S = (size_t)1 << csim->s; // S = 2^s cache sets in cache_sim
+    size_t lines = S * csim->E;      // S * E lines in cache_sim
+
+    if (check_policies(csim->kernel_name, csim->policy_name, csim->E, err, err_len) < 0)
+        return -1;
+
+    csim->set_words = (csim->E + 63) / 64;
+    __uint64_t *slab = (__uint64_t *)malloc((2 * lines + S * csim->set_words) * sizeof(__uint64_t) +
+                                            S * sizeof(unsigned int) + lines);
+    if (!slab)
+    {
+        snprintf(err, err_len, "Cannot allocate %lu cache lines", (unsigned long)lines);
+        return -1;
+    }
+
+    csim->tags = slab;
+    csim->meta = slab + lines;
+    csim->set_bits = slab + 2 * lines;
+    csim->used = (unsigned int *)(csim->set_bits + S * csim->set_words);
+    csim->flags = (unsigned char *)(csim->used + S);
+    csim->find = pick_kernel(csim->kernel_name)->find;
+    csim->policy = pick_policy(csim->policy_name);
+    reset_cache(csim);
+    return 0;
+}
+
+/*
+ * empty every line and clear the statistics, keeping the allocation
+ */
+void reset_cache(struct cache_sim *csim)
+{
+    size_t S = (size_t)1 << csim->s;
+    size_t lines = S * csim->E;
+
+    memset(csim->tags, 0xff, lines * sizeof(__uint64_t)); // INVALID_TAG
+    memset(csim->meta, 0, lines * sizeof(__uint64_t));
+    memset(csim->set_bits, 0, S * csim->set_words * sizeof(__uint64_t));
+    memset(csim->used, 0, S * sizeof(unsigned int));
+    memset(csim->flags, 0, lines);
+    if (csim->policy->reset)
+        csim->policy->reset(csim);
+    csim->clock = 0;
+    csim->hit_count = 0;
+    csim->miss_count = 0;
+    csim->eviction_count = 0;
+    csim->writeback_count = 0;
+    csim->read_bytes = 0;
+    csim->write_bytes = 0;
+    csim->prefetch_issued = 0;
+    csim->prefetch_useful = 0;
+    csim->prefetch_unused = 0;
+    if (csim->pf)
+    { // forget what the prefetcher learned, keeping its degree
+        int degree = csim->pf->degree;
+
+        memset(csim->pf, 0, sizeof(*csim->pf));
+        csim->pf->degree = degree;
+    }
+}
+
+/*
+ * return the named tag-match kernel if this cpu can run it,
+ * or the widest supported one when name is NULL
+ */
+const struct tag_kernel *pick_kernel(const char *name)
+{
+    for (int i = 0; i < num_kernels; i++)
+    {
+        const struct tag_kernel *kernel = &tag_kernels[i];
+
+        if (name && strcmp(name, kernel->name))
+            continue;
+        if (!kernel->supported || kernel->supported())
+            return kernel;
+        if (name)
+            return NULL;
+    }
+    return NULL;
+}
+
+/*
+ * return the named replacement policy, LRU when name is NULL
+ */
+const struct repl_policy *pick_policy(const char *name)
+{
+    for (int i = 0; i < num_policies; i++)
+    {
+        if (!name || !strcmp(name, repl_policies[i].name))
+            return &repl_policies[i];
+    }
+    return NULL;
+}
+
+struct cache_sim *new_csim(void)
+{
+    return calloc(1, sizeof(struct cache_sim)); // set all in csim to zero
+}
+
+/*
+ * simulate the process of accesing cache memory; flatten pulls cache_lookup,
+ * cache_fill and the LRU updates into this, the per-access hot path
+ */
+__attribute__((flatten)) void cache_access(struct cache_sim *csim, __uint64_t addr, int size, int is_store)
+{
+    int verbose = csim->verbose;
+    // a write-back cache holds stores in the line until it is evicted
+    int dirties = is_store && !csim->write_through;
+    __uint64_t victim;
+    int line = cache_lookup(csim, addr);
+
+    if (line >= 0)
+    {
+        if (verbose)
+            printf(" hit");
+        if (dirties)
+            csim->flags[line] |= LINE_DIRTY;
+    }
+    else
+    { // if it's not a hit, then it's a miss
+        if (verbose)
+            printf(" miss");
+
+        // a store that doesn't allocate goes around the cache
+        if (is_store && csim->no_write_allocate)
+        {
+            csim->write_bytes += size;
+            return;
+        }
+
+        // cache current line, evicting one when the cache set is full
+        csim->read_bytes += (__uint64_t)1 << csim->b;
+        if (cache_fill(csim, addr, dirties ? LINE_DIRTY : 0, &victim) && verbose)
+            printf(" eviction");
+    }
+
+    if (is_store && csim->write_through)
+        csim->write_bytes += size;
+    if (csim->prefetcher)
+        train_prefetcher(csim, addr, line);
+}
+
+/*
+ * look addr up, counting a hit or a miss
+ * return the index of its line in the cache after telling the policy the
+ * line was used, -1 on a miss
+ */
+int cache_lookup(struct cache_sim *csim, __uint64_t addr)
+{
+    int s = csim->s;
+    int b = csim->b;
+    int E = csim->E;
+    __uint64_t ci_mask = ((__uint64_t)1 << s) - 1;
+    __uint64_t ci = (addr >> b) & ci_mask;
+    __uint64_t ct = addr >> (s + b);
+    int line = csim->find(csim->tags + ci * E, E, ct);
+
+    if (line < 0)
+    {
+        (csim->miss_count)++;
+        return -1;
+    }
+
+    if (csim->policy == LRU_POLICY)
+        lru_touch(csim, ci, line);
+    else
+        csim->policy->hit(csim, ci, line);
+    (csim->hit_count)++;
+    return ci * E + line;
+}
+
+/*
+ * bring the block of addr, which must not be cached yet, into its set with
+ * the given LINE_* flags, writing back the line it replaces if that one is
+ * dirty
+ * return 1 if a valid line was evicted for it, with the evicted block's
+ * address in *victim
+ */
+int cache_fill(struct cache_sim *csim, __uint64_t addr, int flags, __uint64_t *victim)
+{
+    int s = csim->s;
+    int b = csim->b;
+    int E = csim->E;
+    __uint64_t ci_mask = ((__uint64_t)1 << s) - 1;
+    __uint64_t ci = (addr >> b) & ci_mask;
+    __uint64_t ct = addr >> (s + b);
+    __uint64_t *tags = csim->tags + ci * E;
+    unsigned char *line_flags = csim->flags + ci * E;
+    int evicted = 0;
+    int line;
+
+    // an unused(invalid) line is taken first so that data in valid lines won't lose
+    if (csim->used[ci] < E)
+    {
+        line = csim->find(tags, E, INVALID_TAG);
+        csim->used[ci]++;
+    }
+    else
+    { // Eviction when the cache set is full
+        line = csim->policy == LRU_POLICY ? oldest_victim(csim, ci) : csim->policy->victim(csim, ci);
+        *victim = (tags[line] << (s + b)) | (ci << b);
+        (csim->eviction_count)++;
+        evicted = 1;
+        if (line_flags[line] & LINE_DIRTY)
+        {
+            (csim->writeback_count)++;
+            csim->write_bytes += (__uint64_t)1 << b;
+        }
+        if (line_flags[line] & LINE_PREFETCHED)
+            csim->prefetch_unused++;
+    }
+
+    // write cache info to new cache line
+    tags[line] = ct;
+    line_flags[line] = flags;
+    if (csim->policy == LRU_POLICY)
+        lru_touch(csim, ci, line);
+    else
+        csim->policy->fill(csim, ci, line);
+    return evicted;
+}
+
+/*
+ * return the index of the line holding addr in the cache, -1 if none does,
+ * without counting the lookup or telling the policy
+ */
+int cache_probe(struct cache_sim *csim, __uint64_t addr)
+{
+    int s = csim->s;
+    int b = csim->b;
+    int E = csim->E;
+    __uint64_t ci = (addr >> b) & (((__uint64_t)1 << s) - 1);
+    int line = csim->find(csim->tags + ci * E, E, addr >> (s + b));
+
+    return line < 0 ? -1 : (int)(ci * E) + line;
+}
+
+/*
+ * drop the block of addr from the cache if it is there, writing it back if
+ * it is dirty and leaving its line as reset_cache would; the set's policy
+ * bits are left alone, the line is refilled before the set is full again
+ * and victim is asked
+ * return 1 if it was
+ */
+int cache_invalidate(struct cache_sim *csim, __uint64_t addr)
+{
+    int s = csim->s;
+    int b = csim->b;
+    int E = csim->E;
+    __uint64_t ci = (addr >> b) & (((__uint64_t)1 << s) - 1);
+    __uint64_t *tags = csim->tags + ci * E;
+    int line = csim->find(tags, E, addr >> (s + b));
+    size_t i;
+
+    if (line < 0)
+        return 0;
+
+    i = ci * E + line;
+    if (csim->flags[i] & LINE_DIRTY)
+    {
+        (csim->writeback_count)++;
+        csim->write_bytes += (__uint64_t)1 << b;
+    }
+    if (csim->flags[i] & LINE_PREFETCHED)
+        csim->prefetch_unused++;
+    tags[line] = INVALID_TAG;
+    csim->flags[i] = 0;
+    csim->meta[i] = 0;
+    csim->used[ci]--;
+    return 1;
+}
+
+/*
+ * return the index of the line holding tag ct in a set of E tags
+ * return -1 if not find, empty lines never match since they hold INVALID_TAG
+ */
+int find_cline(const __uint64_t *tags, int E, __uint64_t ct)
+{
+    for (int i = 0; i < E; i++)
+    {
+        if (tags[i] == ct)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * SSE4.2 version of find_cline, compares 4 tags per step and picks the
+ * first matching lane from the movemask
+ */
+__attribute__((target("sse4.2"))) int find_cline_sse42(const __uint64_t *tags, int E, __uint64_t ct)
+{
+    __m128i key = _mm_set1_epi64x((long long)ct);
+    int i = 0;
+
+    for (; i + 4 <= E; i += 4)
+    {
+        __m128i lo = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)(tags + i)), key);
+        __m128i hi = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)(tags + i + 2)), key);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(lo)) |
+                   _mm_movemask_pd(_mm_castsi128_pd(hi)) << 2;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    for (; i < E; i++)
+    {
+        if (tags[i] == ct)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * AVX2 version of find_cline, compares 8 tags per step and picks the
+ * first matching lane from the movemask
+ */
+__attribute__((target("avx2"))) int find_cline_avx2(const __uint64_t *tags, int E, __uint64_t ct)
+{
+    __m256i key = _mm256_set1_epi64x((long long)ct);
+    int i = 0;
+
+    for (; i + 8 <= E; i += 8)
+    {
+        __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(tags + i)), key);
+        __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(tags + i + 4)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+                   _mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    if (i + 4 <= E)
+    {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(tags + i)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (mask)
+            return i + __builtin_ctz(mask);
+        i += 4;
+    }
+    for (; i < E; i++)
+    {
+        if (tags[i] == ct)
+            return i;
+    }
+    return -1;
+}
+
+int has_sse42(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+int has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/*
+ * return the index of the line with the smallest metadata word in a set of E,
+ * the least recently used line for LRU, the oldest one for FIFO and the
+ * least frequently used one for LFU
+ */
+int get_victim(const __uint64_t *meta, int E)
+{
+    int victim = 0;
+    __uint64_t oldest = meta[0]; // kept in a register, not reloaded per line
+
+    for (int i = 1; i < E; i++)
+    {
+        if (meta[i] < oldest)
+        {
+            oldest = meta[i];
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+/*
+ * LRU: restamp the used line, so it is the last one for evictions
+ */
+static void lru_touch(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    csim->meta[ci * csim->E + line] = ++(csim->clock);
+}
+
+static int oldest_victim(struct cache_sim *csim, __uint64_t ci)
+{
+    return get_victim(csim->meta + ci * csim->E, csim->E);
+}
+
+/*
+ * FIFO: stamp a line only when it is filled
+ */
+static void fifo_fill(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    csim->meta[ci * csim->E + line] = ++(csim->clock);
+}
+
+static void no_touch(struct cache_sim *csim, __uint64_t ci, int line)
+{
+}
+
+/*
+ * step the xorshift state kept in the first policy word of set ci, so the
+ * random choices of a set don't depend on the other sets or on -j
+ */
+static __uint64_t next_random(struct cache_sim *csim, __uint64_t ci)
+{
+    __uint64_t *state = &csim->set_bits[ci * csim->set_words];
+
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void seed_sets(struct cache_sim *csim)
+{
+    for (size_t i = 0; i < ((size_t)1 << csim->s); i++)
+        csim->set_bits[i * csim->set_words] = (i + 1) * 0x9e3779b97f4a7c15ull;
+}
+
+static int random_victim(struct cache_sim *csim, __uint64_t ci)
+{
+    return next_random(csim, ci) % csim->E;
+}
+
+/*
+ * LFU: count the uses of a line since it was filled
+ */
+static void lfu_hit(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    csim->meta[ci * csim->E + line]++;
+}
+
+static void lfu_fill(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    csim->meta[ci * csim->E + line] = 1;
+}
+
+/*
+ * Tree-PLRU: the E - 1 bits of a set form a binary tree over its lines,
+ * node n has children 2n and 2n + 1 and its bit points to the colder half
+ */
+static void plru_touch(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    __uint64_t *bits = csim->set_bits + ci * csim->set_words;
+    int E = csim->E;
+
+    // walk up from the leaf, pointing every node away from this line
+    for (int n = E + line; n > 1; n >>= 1)
+    {
+        int parent = n >> 1;
+        __uint64_t mask = (__uint64_t)1 << (parent & 63);
+
+        if (n & 1)
+            bits[parent >> 6] &= ~mask;
+        else
+            bits[parent >> 6] |= mask;
+    }
+}
+
+static int plru_victim(struct cache_sim *csim, __uint64_t ci)
+{
+    const __uint64_t *bits = csim->set_bits + ci * csim->set_words;
+    int n = 1;
+
+    while (n < csim->E)
+        n = 2 * n + ((bits[n >> 6] >> (n & 63)) & 1);
+    return n - csim->E;
+}
+
+/*
+ * Bit-PLRU: one MRU bit per line, cleared for all other lines once every
+ * line of the set has been used
+ */
+static void bitplru_touch(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    __uint64_t *bits = csim->set_bits + ci * csim->set_words;
+    int words = csim->set_words;
+    int full = 1;
+
+    bits[line >> 6] |= (__uint64_t)1 << (line & 63);
+    for (int w = 0; w < words && full; w++)
+    {
+        int used = csim->E - 64 * w; // lines covered by this word
+        __uint64_t all = used >= 64 ? ~(__uint64_t)0 : ((__uint64_t)1 << used) - 1;
+
+        full = bits[w] == all;
+    }
+    if (full)
+    {
+        memset(bits, 0, words * sizeof(__uint64_t));
+        bits[line >> 6] = (__uint64_t)1 << (line & 63);
+    }
+}
+
+static int bitplru_victim(struct cache_sim *csim, __uint64_t ci)
+{
+    const __uint64_t *bits = csim->set_bits + ci * csim->set_words;
+
+    // with E = 1 the only line is always the MRU one, and the victim
+    for (int w = 0; w < csim->set_words; w++)
+    {
+        if (~bits[w])
+        {
+            int line = 64 * w + __builtin_ctzll(~bits[w]);
+            return line < csim->E ? line : 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * SRRIP/BRRIP with 2-bit re-reference prediction values (RRPV): a hit
+ * predicts a near re-reference, the victim is a line predicted distant
+ */
+#define RRPV_MAX 3
+#define BRRIP_LONG_ODDS 32 // BRRIP inserts at RRPV_MAX - 1 once in this many fills
+
+static void rrip_hit(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    csim->meta[ci * csim->E + line] = 0;
+}
+
+static void srrip_fill(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    csim->meta[ci * csim->E + line] = RRPV_MAX - 1;
+}
+
+static void brrip_fill(struct cache_sim *csim, __uint64_t ci, int line)
+{
+    int rare = next_random(csim, ci) % BRRIP_LONG_ODDS == 0;
+
+    csim->meta[ci * csim->E + line] = rare ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+static int rrip_victim(struct cache_sim *csim, __uint64_t ci)
+{
+    __uint64_t *rrpv = csim->meta + ci * csim->E;
+    int oldest = 0;
+
+    // age every line by the amount that brings the most distant one to RRPV_MAX
+    for (int i = 1; i < csim->E; i++)
+    {
+        if (rrpv[i] > rrpv[oldest])
+            oldest = i;
+    }
+    if (rrpv[oldest] < RRPV_MAX)
+    {
+        __uint64_t step = RRPV_MAX - rrpv[oldest];
+
+        for (int i = 0; i < csim->E; i++)
+            rrpv[i] += step;
+    }
+    return oldest;
+}
+
+/*
+ * parse a -p prefetcher spec, "<name>" or "<name>:<degree>"
+ * return -1 for an unknown name or a bad degree
+ */
+int parse_prefetcher(struct cache_sim *csim, const char *spec)
+{
+    int degree;
+    const struct prefetcher *prefetcher = find_prefetcher(spec, &degree);
+
+    if (!prefetcher)
+        return -1;
+    csim->prefetcher = prefetcher;
+    free(csim->pf);
+    csim->pf = calloc(1, sizeof(struct prefetch_state));
+    if (!csim->pf)
+        return -1;
+    csim->pf->degree = degree;
+    return 0;
+}
+
+/*
+ * return 0 if spec names a prefetcher as parse_prefetcher takes it, else -1
+ */
+int check_prefetcher(const char *spec)
+{
+    int degree;
+
+    return find_prefetcher(spec, &degree) ? 0 : -1;
+}
+
+/*
+ * return the prefetcher named by spec, name[:N], with its degree in
+ * *degree, NULL if there is none or N isn't positive
+ */
+static const struct prefetcher *find_prefetcher(const char *spec, int *degree)
+{
+    const char *colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+    for (int i = 0; i < NUM_PREFETCHERS; i++)
+    {
+        if (strlen(prefetchers[i].name) != len || strncmp(prefetchers[i].name, spec, len))
+            continue;
+
+        *degree = colon ? atoi(colon + 1) : prefetchers[i].degree;
+        return *degree > 0 ? &prefetchers[i] : NULL;
+    }
+    return NULL;
+}
+
+/*
+ * tell the prefetcher about a demand access that hit line, or missed when
+ * line is -1; a hit on a prefetched line counts as a useful prefetch
+ */
+static void train_prefetcher(struct cache_sim *csim, __uint64_t addr, int line)
+{
+    int miss = line < 0;
+
+    if (!miss && (csim->flags[line] & LINE_PREFETCHED))
+    {
+        csim->flags[line] &= ~LINE_PREFETCHED;
+        csim->prefetch_useful++;
+        miss = 1; // the miss it saved trains the prefetcher like one
+    }
+    csim->prefetcher->train(csim, addr, miss);
+}
+
+/*
+ * bring block into the cache as a prefetched line unless it is already there
+ */
+static void prefetch_block(struct cache_sim *csim, __uint64_t block)
+{
+    __uint64_t addr = block << csim->b;
+    __uint64_t victim;
+
+    if (cache_probe(csim, addr) >= 0)
+        return;
+    csim->prefetch_issued++;
+    csim->read_bytes += (__uint64_t)1 << csim->b;
+    cache_fill(csim, addr, LINE_PREFETCHED, &victim);
+}
+
+/*
+ * next-N-line: every miss fetches the degree blocks after it
+ */
+static void next_line_train(struct cache_sim *csim, __uint64_t addr, int miss)
+{
+    __uint64_t block = addr >> csim->b;
+
+    if (!miss)
+        return;
+    for (int k = 1; k <= csim->pf->degree; k++)
+        prefetch_block(csim, block + k);
+}
+
+/*
+ * stride table: accesses are grouped by the instruction that issued them,
+ * or by their 4KB region in traces without I records; once the same
+ * stride has been seen twice in a row the next degree strides are fetched
+ */
+static void stride_train(struct cache_sim *csim, __uint64_t addr, int miss)
+{
+    struct prefetch_state *pf = csim->pf;
+    __uint64_t key = pf->pc ? pf->pc : addr >> STRIDE_REGION_BITS;
+    struct stride_entry *e = &pf->strides[(key * 0x9e3779b97f4a7c15ull) >> (64 - STRIDE_BITS)];
+    __int64_t stride;
+
+    if (!e->valid || e->key != key)
+    {
+        e->valid = 1;
+        e->key = key;
+        e->last_addr = addr;
+        e->stride = 0;
+        e->confidence = 0;
+        return;
+    }
+
+    // a modify touches the same address twice
+    stride = (__int64_t)(addr - e->last_addr);
+    if (stride == 0)
+        return;
+    if (stride == e->stride)
+    {
+        if (e->confidence < STRIDE_CONFIDENT)
+            e->confidence++;
+    }
+    else
+    {
+        e->stride = stride;
+        e->confidence = 0;
+    }
+    e->last_addr = addr;
+
+    if (e->confidence < STRIDE_CONFIDENT)
+        return;
+    for (int k = 1; k <= pf->degree; k++)
+    {
+        __uint64_t block = (addr + k * stride) >> csim->b;
+
+        if (block != addr >> csim->b)
+            prefetch_block(csim, block);
+    }
+}
+
+/*
+ * stream detector: a miss within STREAM_WINDOW blocks ahead of a tracked
+ * stream advances it, the second one in a row fixes its direction, and
+ * from then on the degree blocks ahead of it are fetched; a miss no
+ * stream claims starts a new one in place of the least recently used
+ */
+static void stream_train(struct cache_sim *csim, __uint64_t addr, int miss)
+{
+    struct prefetch_state *pf = csim->pf;
+    __uint64_t block = addr >> csim->b;
+    struct stream_entry *lru = &pf->streams[0];
+
+    if (!miss)
+        return;
+    pf->clock++;
+    for (int i = 0; i < STREAM_ENTRIES; i++)
+    {
+        struct stream_entry *e = &pf->streams[i];
+        __int64_t ahead = (__int64_t)(block - e->last_block);
+
+        if (e->stamp < lru->stamp)
+            lru = e;
+        if (!e->stamp || ahead == 0)
+            continue;
+
+        // a young stream takes its direction from the first miss near it
+        if (!e->dir && ahead >= -STREAM_WINDOW && ahead <= STREAM_WINDOW)
+            e->dir = ahead > 0 ? 1 : -1;
+        if (ahead * e->dir <= 0 || ahead * e->dir > STREAM_WINDOW)
+            continue;
+
+        e->last_block = block;
+        e->stamp = pf->clock;
+        for (int k = 1; k <= pf->degree; k++)
+            prefetch_block(csim, block + k * e->dir);
+        return;
+    }
+
+    lru->last_block = block;
+    lru->dir = 0;
+    lru->stamp = pf->clock;
+}
+
+/*
+ * parse a -W write policy such as "wt,nwa": wb or wt picks write-back or
+ * write-through, wa or nwa write-allocate or no-write-allocate
+ */
+int parse_write_policy(struct cache_sim *csim, const char *spec)
+{
+    char buf[32];
+    char *tok, *save;
+
+    if (strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        if (!strcmp(tok, "wb"))
+            csim->write_through = 0;
+        else if (!strcmp(tok, "wt"))
+            csim->write_through = 1;
+        else if (!strcmp(tok, "wa"))
+            csim->no_write_allocate = 0;
+        else if (!strcmp(tok, "nwa"))
+            csim->no_write_allocate = 1;
+        else
+            return -1;
+    }
+    return 0;
+}
+
+void free_csim(struct cache_sim *csim)
+{
+    free(csim->tags); // tags start the slab holding every line
+    free(csim->pf);
+    free(csim);
+}
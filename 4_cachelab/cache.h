@@ -0,0 +1,189 @@
+/*
+ * cache.h - The set-associative cache model shared by csim and libcsim
+ *
+ * A cache_sim holds every line of the cache in one slab; cache_access
+ * replays a single load or store against it, and the lookup, fill, probe
+ * and invalidate steps it is made of are exported for the multi-level
+ * hierarchy. Replacement policies, tag-match kernels and prefetchers are
+ * chosen by name from the tables in cache.c.
+ */
+
+#ifndef CSIM_CACHE_H
+#define CSIM_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Tag stored in a line that holds no block; no real tag can reach it */
+#define INVALID_TAG (~(__uint64_t)0)
+
+/* Bits of the per-line flags byte */
+#define LINE_DIRTY 1      // modified since it was filled
+#define LINE_PREFETCHED 2 // filled by the prefetcher, no demand access yet
+
+#define STRIDE_BITS 8         // log2 of the stride prefetcher's table entries
+#define STRIDE_REGION_BITS 12 // stride key of traces without I records: 4KB region
+#define STRIDE_CONFIDENT 2    // repeats of a stride before it is prefetched
+#define STREAM_ENTRIES 16     // streams the stream prefetcher tracks
+#define STREAM_WINDOW 16      // blocks ahead of a stream a miss still joins it
+
+/* Return the index of the line holding a tag in a set, -1 if none does */
+typedef int (*find_fn)(const __uint64_t *tags, int E, __uint64_t ct);
+
+struct cache_sim;
+
+/*
+ * A replacement policy. hit and fill update the metadata of a line that was
+ * just used or filled; victim picks the line to evict from a full set.
+ */
+struct repl_policy
+{
+    const char *name;
+    void (*hit)(struct cache_sim *csim, __uint64_t ci, int line);
+    void (*fill)(struct cache_sim *csim, __uint64_t ci, int line);
+    int (*victim)(struct cache_sim *csim, __uint64_t ci);
+    void (*reset)(struct cache_sim *csim); // seeds set_bits, NULL if zeroes do
+    int pow2_only;                         // needs a power of two E
+};
+
+/* A tag-match kernel and the cpu feature check guarding it */
+struct tag_kernel
+{
+    const char *name;
+    find_fn find;
+    int (*supported)(void);
+};
+
+/* One stride prefetcher table entry, keyed by instruction or region */
+struct stride_entry
+{
+    int valid;
+    __uint64_t key;
+    __uint64_t last_addr;
+    __int64_t stride;
+    int confidence;
+};
+
+/* A stream of misses walking through memory one way */
+struct stream_entry
+{
+    __uint64_t last_block;
+    int dir;          // +1 or -1 once known, 0 for a new stream
+    __uint64_t stamp; // last use, 0 for an unused entry
+};
+
+/* State shared by the -p prefetchers */
+struct prefetch_state
+{
+    int degree;    // blocks fetched per trigger
+    __uint64_t pc; // address of the last I record, 0 if none seen
+    struct stride_entry strides[1 << STRIDE_BITS];
+    struct stream_entry streams[STREAM_ENTRIES];
+    __uint64_t clock;
+};
+
+/*
+ * A prefetcher. train sees every demand access, with miss set for misses
+ * and first hits on prefetched lines, and issues prefetch_block calls.
+ */
+struct prefetcher
+{
+    const char *name;
+    void (*train)(struct cache_sim *csim, __uint64_t addr, int miss);
+    int degree; // default blocks fetched per trigger
+};
+
+/*
+ * One simulated cache. The options up to trace_file are filled in from the
+ * command line by csim; the library and alloc_cache only read verbose,
+ * kernel_name, policy_name, the write policy, the prefetcher, s, E and b.
+ */
+struct cache_sim
+{
+    int verbose;
+    int bench;          // replay the trace once per tag-match kernel and policy
+    int parse_bench;    // time a parse-only pass over the trace first
+    char *kernel_name;  // tag-match kernel forced by -k, NULL picks the best
+    char *policy_name;  // -R replacement policy, NULL is LRU
+    char *sweep_spec;   // -S parameter ranges, one cache per combination
+    int max_E;          // -D largest associativity of the miss-ratio curve
+    int threads;        // -j workers of the parallel replay
+    char *hierarchy_file; // -H config of a multi-level hierarchy
+    char *marker_file;     // --window-from-marker, NULL replays the whole trace
+    char *label_file;      // -A address ranges to attribute misses to
+    char *csv_file;        // -o attribution CSV, NULL writes to stdout
+    int classify;          // -C split misses into cold, capacity and conflict
+    const struct prefetcher *prefetcher; // -p prefetcher, NULL for none
+    struct prefetch_state *pf;
+    int write_report;      // -W given, print the memory traffic summary
+    int write_through;     // stores go straight to memory instead of dirtying lines
+    int no_write_allocate; // store misses bypass the cache
+    int s; // 2^s cache sets in cache_sim
+    int E; // E cache lines in each of the cache sets
+    int b; // 2^b bytes block each line
+    char *trace_file;
+
+    long hit_count;
+    long miss_count;
+    long eviction_count;
+    long writeback_count;   // dirty lines written back on eviction or invalidation
+    __uint64_t read_bytes;  // bytes fetched from memory by fills
+    __uint64_t write_bytes; // bytes written to memory by writebacks and stores
+    long cold_misses;       // -C: first use of the block
+    long capacity_misses;   // -C: a fully associative LRU cache misses too
+    long conflict_misses;   // -C: only the set mapping made it miss
+    long prefetch_issued;   // blocks the prefetcher brought in
+    long prefetch_useful;   // prefetched lines later hit by a demand access
+    long prefetch_unused;   // prefetched lines evicted without being used
+
+    /*
+     * All arrays are carved out of a single slab and laid out set-major,
+     * so the E lines of set i live at [i * E, i * E + E) and its policy
+     * bits at [i * set_words, i * set_words + set_words).
+     */
+    __uint64_t *tags;     // tag of each line, INVALID_TAG when the line is empty
+    __uint64_t *meta;     // per-line policy word: LRU/FIFO stamp, LFU count, RRPV
+    __uint64_t *set_bits; // per-set policy bits: PLRU tree or MRU bits, rng state
+    unsigned int *used;   // valid lines in each set
+    unsigned char *flags; // LINE_* bits of each line
+    int set_words;        // words of set_bits per set, one bit per line
+    __uint64_t clock;     // stamp handed to the most recently used line
+
+    find_fn find;                     // tag-match kernel used by cache_access
+    const struct repl_policy *policy; // replacement policy used by cache_access
+};
+
+/* Tag-match kernels from the widest to the scalar fallback */
+extern const struct tag_kernel tag_kernels[];
+extern const int num_kernels;
+
+/* Replacement policies selectable with -R, LRU is the default */
+extern const struct repl_policy repl_policies[];
+extern const int num_policies;
+
+struct cache_sim *new_csim(void);
+int check_policies(const char *kernel_name, const char *policy_name, int E,
+                   char *err, size_t err_len);
+int alloc_cache(struct cache_sim *csim, char *err, size_t err_len);
+void reset_cache(struct cache_sim *csim);
+void free_csim(struct cache_sim *csim);
+const struct tag_kernel *pick_kernel(const char *name);
+const struct repl_policy *pick_policy(const char *name);
+int parse_prefetcher(struct cache_sim *csim, const char *spec);
+int check_prefetcher(const char *spec);
+int parse_write_policy(struct cache_sim *csim, const char *spec);
+
+void cache_access(struct cache_sim *csim, __uint64_t addr, int size, int is_store);
+int cache_lookup(struct cache_sim *csim, __uint64_t addr);
+int cache_fill(struct cache_sim *csim, __uint64_t addr, int flags, __uint64_t *victim);
+int cache_probe(struct cache_sim *csim, __uint64_t addr);
+int cache_invalidate(struct cache_sim *csim, __uint64_t addr);
+
+int find_cline(const __uint64_t *tags, int E, __uint64_t ct);
+int find_cline_sse42(const __uint64_t *tags, int E, __uint64_t ct);
+int find_cline_avx2(const __uint64_t *tags, int E, __uint64_t ct);
+int has_sse42(void);
+int has_avx2(void);
+int get_victim(const __uint64_t *meta, int E);
+
+#endif /* CSIM_CACHE_H */
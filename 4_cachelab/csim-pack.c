@@ -0,0 +1,147 @@
+/*
+ * csim-pack.c - Convert a valgrind lackey text trace into the packed
+ * binary trace format described in trace.h. csim detects packed traces
+ * by their magic and replays them directly, so a trace that is swept over
+ * many cache configurations only has to be converted once.
+ */
+
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <string.h>
+
+static void print_help(void);
+static void put_varint(FILE *out, __uint64_t v);
+static int pack_op(char type);
+
+int main(int argc, char *argv[])
+{
+    char *in_name = NULL;
+    char *out_name = NULL;
+    int drop_insn = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hdt:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            drop_insn = 1;
+            break;
+        case 't':
+            in_name = optarg;
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'h':
+        default:
+            print_help();
+            exit(1);
+        }
+    }
+    if (!in_name || !out_name)
+    {
+        print_help();
+        exit(1);
+    }
+
+    struct trace_reader r;
+    struct access rec;
+    if (open_trace(&r, in_name) < 0)
+        exit(1);
+
+    FILE *out = fopen(out_name, "wb");
+    if (!out)
+    {
+        printf("Cannot create %s\n", out_name);
+        exit(1);
+    }
+
+    // the record count is patched in once the whole trace has been read
+    __uint64_t count = 0;
+    unsigned int name_len = strlen(in_name);
+    fwrite(PACK_MAGIC, 1, PACK_MAGIC_LEN, out);
+    fwrite(&count, sizeof(count), 1, out);
+    fwrite(&name_len, sizeof(name_len), 1, out);
+    fwrite(in_name, 1, name_len, out);
+
+    __uint64_t prev_addr = 0;
+    while (next_record(&r, &rec))
+    {
+        int op = pack_op(rec.type);
+
+        if (op < 0 || (drop_insn && rec.type == 'I'))
+            continue;
+
+        // zigzag the delta so a small step backwards stays a short varint
+        __int64_t delta = (__int64_t)(rec.addr - prev_addr);
+        __uint64_t zigzag = ((__uint64_t)delta << 1) ^ (__uint64_t)(delta >> 63);
+
+        if (rec.size >= 0 && rec.size < PACK_SIZE_ESC)
+            putc(op | rec.size << 2, out);
+        else
+        {
+            putc(op | PACK_SIZE_ESC << 2, out);
+            put_varint(out, (unsigned int)rec.size);
+        }
+        put_varint(out, zigzag);
+
+        prev_addr = rec.addr;
+        count++;
+    }
+
+    long in_bytes = r.bytes;
+    long out_bytes = ftell(out);
+    close_trace(&r);
+
+    fseek(out, PACK_MAGIC_LEN, SEEK_SET);
+    fwrite(&count, sizeof(count), 1, out);
+    if (fclose(out))
+    {
+        printf("Error writing %s\n", out_name);
+        exit(1);
+    }
+
+    printf("%s: %lu records, %ld bytes -> %ld bytes (%.2f bytes/record)\n",
+           out_name, (unsigned long)count, in_bytes, out_bytes,
+           count ? (double)out_bytes / count : 0.0);
+    return 0;
+}
+
+/*
+ * return the 2-bit code of an op, -1 for anything that isn't one
+ */
+static int pack_op(char type)
+{
+    const char *op = strchr(PACK_OPS, type);
+
+    return (type && op) ? op - PACK_OPS : -1;
+}
+
+/*
+ * write v as a LEB128 varint, 7 bits per byte, low bits first
+ */
+static void put_varint(FILE *out, __uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        putc((v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc(v, out);
+}
+
+static void print_help(void)
+{
+    printf("Usage: ./csim-pack [-hd] -t <tracefile> -o <packfile>\n");
+    printf("Options:\n");
+    printf("  -h              Print this help message.\n");
+    printf("  -d              Drop instruction (I) records.\n");
+    printf("  -t <tracefile>  Valgrind trace to convert.\n");
+    printf("  -o <packfile>   Packed trace to write.\n\n");
+    printf("Examples:\n");
+    printf("  linux>  ./csim-pack -t traces/long.trace -o long.pack\n");
+    printf("  linux>  ./csim -s 4 -E 1 -b 4 -t long.pack\n");
+}
@@ -8,314 +8,1488 @@
  * @date April 17, 2020
  */
 
+#define _POSIX_C_SOURCE 200809L // for clock_gettime and pthreads
+
 #include "cachelab.h"
+#include "cache.h"
+#include "libcsim.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <getopt.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_SWEEP_VALUES 64 // values one sweep parameter can take
+#define BATCH_RECORDS 4096  // records decoded before they are fed to the caches
+#define NO_OWNER (~0u)      // reuse_set time whose block has been used again
+#define REPLAY_BATCHES 4    // batches in flight between the reader and the workers
+#define MAX_LEVELS 8        // cache levels in a -H hierarchy
+#define ATTR_COUNTERS 3     // hits, misses and evictions of an attribution row
+#define MAX_REGION_ROWS (1 << 20) // rows one -A region can be split into
 
-struct cache_line
+/* A block seen by a reuse_tracker and the set-local time of its last use */
+struct reuse_block
 {
-    int valid;
-    __uint64_t tag;
+    __uint64_t block;
+    unsigned int time;
+};
 
-    struct cache_line *prev;
-    struct cache_line *next;
+/*
+ * Per-set LRU stack for reuse distances: bit i of the Fenwick tree is set
+ * when owner[i] is the block whose last use was at set-local time i, so the
+ * distance of a reuse is the number of bits set since its previous use.
+ */
+struct reuse_set
+{
+    int *tree;           // Fenwick tree over the times [0, cap)
+    unsigned int *owner; // block index used at each time, or NO_OWNER
+    unsigned int time;   // next time to hand out
+    unsigned int cap;
+    unsigned int blocks; // distinct blocks seen in this set
 };
 
-struct cache_set
+/*
+ * Reuse (stack) distance engine for LRU caches of every associativity at
+ * once: a hash map from block address to its reuse_block, and one
+ * reuse_set per cache set.
+ */
+struct reuse_tracker
 {
-    int E; // E cache lines in each of the cache sets
-    struct cache_line *head;
-    struct cache_line *tail;
+    int s;
+    struct reuse_set *sets;
+    struct reuse_block *blocks; // every block seen so far, in first-use order
+    size_t num_blocks;
+    size_t cap_blocks;
+    unsigned int *index; // open-addressed hash of block index + 1, 0 is empty
+    size_t index_mask;
 };
 
-struct cache_sim
+/*
+ * A batch of records split by the worker owning their set, so each
+ * worker replays only its own part, in trace order
+ */
+struct replay_batch
 {
-    int verbose;
-    int s; // 2^s cache sets in cache_sim
-    int E; // E cache lines in each of the cache sets
-    int b; // 2^b bytes block each line
-    char *trace_file;
+    struct access **parts; // records of each worker
+    int *counts;           // records in each part
+    long seq;              // index of the batch in the trace, -1 before the first
+    int pending;           // workers still replaying this batch
+    int last;              // no batch follows this one
+};
 
-    int hit_count;
-    int miss_count;
-    int eviction_count;
+/* State shared by the reader and the workers of a parallel replay */
+struct replay_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct replay_batch batches[REPLAY_BATCHES];
+};
 
-    struct cache_set **cache;
+/* One replay worker and the private view of the cache it replays into */
+struct replay_worker
+{
+    pthread_t thread;
+    int id;
+    struct replay_pool *pool;
+    struct cache_sim *csim;
 };
 
-void alloc_cache(struct cache_sim *csim);
+/* How a hierarchy level relates to the contents of the levels above it */
+enum inclusion
+{
+    INCL_NONE,      // the first level
+    INCL_INCLUSIVE, // holds every block above, evictions back-invalidate them
+    INCL_EXCLUSIVE, // holds only blocks evicted from the level above
+    INCL_NINE,      // filled on misses, evictions leave the levels above alone
+};
+
+/* One level of a -H hierarchy */
+struct cache_level
+{
+    char name[16];
+    char policy[16]; // replacement policy from the config, empty for the -R one
+    struct cache_sim *cache;
+    int latency;     // cycles to probe this level
+    enum inclusion inclusion;
+    long back_invalidations; // blocks above removed by this level's evictions
+};
+
+/* Levels of a -H hierarchy from L1 down, backed by memory */
+struct hierarchy
+{
+    struct cache_level levels[MAX_LEVELS];
+    int num_levels;
+    int mem_latency;
+    long mem_accesses;
+    long accesses;
+    __uint64_t cycles;
+};
+
+/* A labelled address range for -A, split into rows of stride bytes */
+struct region
+{
+    char name[32];
+    __uint64_t start;
+    __uint64_t end;    // one past the last byte
+    __uint64_t stride; // bytes per row, 0 keeps the region whole
+    int rows;
+    int first; // counter row of the region's first row
+};
+
+/*
+ * Regions sorted by start address and one flat array of ATTR_COUNTERS
+ * counters per row; the row after the last region's counts accesses
+ * no label covers
+ */
+struct attribution
+{
+    struct region *regions;
+    int num_regions;
+    int last; // region of the previous lookup, tried first
+    __uint64_t *counts;
+};
+
+void setup_cache(struct cache_sim *csim);
 void print_help(void);
-void add_cline(struct cache_set *cset);
 void simulate(struct cache_sim *csim);
-void cache_access(struct cache_sim *csim, __uint64_t addr, int size);
-void prepend_line(struct cache_set *cset, struct cache_line *cline);
-void remove_line(struct cache_line *cline);
-void free_csim(struct cache_sim *csim);
-void free_cset(struct cache_set *cset);
-int is_arg_valid(struct cache_sim *csim);
-struct cache_sim *new_csim(void);
+void benchmark(struct cache_sim *csim);
+void replay(struct cache_sim *csim, const struct access *trace, size_t n);
+void time_replay(struct cache_sim *csim, const struct access *trace, size_t n,
+                 const char *what, const char *name);
+void print_prefetch(struct cache_sim *csim);
+void print_traffic(struct cache_sim *csim);
 struct cache_sim *cache_init(int argc, char *argv[]);
-struct cache_line *find_cline(struct cache_set *cset, __uint64_t ct);
-struct cache_line *get_cline(struct cache_set *cset, __uint64_t ct);
-struct cache_set *new_cset(int E);
+struct access *load_trace(struct cache_sim *csim, size_t *n);
+void measure_parse(struct cache_sim *csim);
+int open_csim_trace(struct cache_sim *csim, struct trace_reader *r);
+void sweep(struct cache_sim *csim);
+int parse_sweep(const char *spec, int values[3][MAX_SWEEP_VALUES], int counts[3]);
+void analyze_reuse(struct cache_sim *csim);
+void parallel_simulate(struct cache_sim *csim);
+void *replay_worker(void *arg);
+struct reuse_tracker *new_reuse_tracker(int s);
+void free_reuse_tracker(struct reuse_tracker *rt);
+long reuse_distance(struct reuse_tracker *rt, __uint64_t block);
+void simulate_hierarchy(struct cache_sim *csim);
+struct hierarchy *load_hierarchy(struct cache_sim *csim);
+void hierarchy_access(struct hierarchy *h, __uint64_t addr, int verbose);
+void hierarchy_evict(struct hierarchy *h, int k, __uint64_t victim);
+void attribute(struct cache_sim *csim);
+struct attribution *load_labels(const char *label_file);
+int find_region(struct attribution *at, __uint64_t addr);
+static int cmp_region(const void *a, const void *b);
+void classify_misses(struct cache_sim *csim);
 
 int main(int argc, char *argv[])
 {
     struct cache_sim *csim;
 
     csim = cache_init(argc, argv);
-    if (is_arg_valid(csim))
+    if (csim->sweep_spec)
+    {
+        sweep(csim);
+        free(csim);
+        return 0;
+    }
+    if (csim->max_E)
+    {
+        analyze_reuse(csim);
+        free(csim);
+        return 0;
+    }
+    if (csim->hierarchy_file)
     {
-        alloc_cache(csim);
+        simulate_hierarchy(csim);
+        free(csim);
+        return 0;
     }
+    setup_cache(csim);
 
-    simulate(csim);
+    if (csim->parse_bench)
+        measure_parse(csim);
+    if (csim->bench)
+        benchmark(csim);
+    else if (csim->label_file)
+        attribute(csim);
+    else if (csim->classify)
+        classify_misses(csim);
+    else if (csim->threads > 1)
+        parallel_simulate(csim);
+    else
+        simulate(csim);
     printSummary(csim->hit_count, csim->miss_count, csim->eviction_count);
+    if (csim->write_report)
+        print_traffic(csim);
+    if (csim->prefetcher)
+        print_prefetch(csim);
+    if (csim->classify)
+        printf("cold:%ld capacity:%ld conflict:%ld\n",
+               csim->cold_misses, csim->capacity_misses, csim->conflict_misses);
 
     free_csim(csim);
     return 0;
 }
 
-int is_arg_valid(struct cache_sim *csim)
+/*
+ * allocate the cache set up on the command line, exiting on a bad configuration
+ */
+void setup_cache(struct cache_sim *csim)
 {
-    return csim->s > 0 && csim->E > 0 && csim->b > 0 && csim->trace_file;
+    struct csim_config cfg = {.s = csim->s, .E = csim->E, .b = csim->b,
+                              .policy = csim->policy_name, .kernel = csim->kernel_name};
+    char err[128];
+
+    if (csim_check_config(&cfg, err, sizeof(err)) < 0 || alloc_cache(csim, err, sizeof(err)) < 0)
+    {
+        printf("%s\n", err);
+        exit(1);
+    }
 }
 
-void alloc_cache(struct cache_sim *csim)
+void simulate(struct cache_sim *csim)
 {
-    int S = 1 << (csim->s); // S = 2^s cache sets in cache_sim
-    int E = csim->E;        // E cache lines in each of the cache sets
-    struct cache_set **cache = (struct cache_set **)malloc(sizeof(struct cache_set *) * S);
+    struct trace_reader r;
+    struct access rec;
+    int verbose = csim->verbose;
+
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
 
-    // allocate space for cache lines
-    for (int i = 0; i < S; i++)
+    while (next_record(&r, &rec))
     {
-        cache[i] = new_cset(E);
+        if (verbose && rec.type != 'I')
+            printf("%c %lx, %d", rec.type, rec.addr, rec.size);
+        switch (rec.type)
+        {
+        case 'I':
+            // the data accesses that follow belong to this instruction
+            if (csim->pf)
+                csim->pf->pc = rec.addr;
+            break;
+        case 'L':
+            // a data load
+            cache_access(csim, rec.addr, rec.size, 0);
+            break;
+        case 'S':
+            // a data store
+            cache_access(csim, rec.addr, rec.size, 1);
+            break;
+        case 'M':
+            // a data modify
+            cache_access(csim, rec.addr, rec.size, 0); // a data load
+            cache_access(csim, rec.addr, rec.size, 1); // followed by a data store
+            break;
+        }
+        if (verbose)
+            printf("\n");
     }
+    close_trace(&r);
+}
 
-    csim->cache = cache;
+/*
+ * open the -t trace, restricted to the marker window if one was asked for
+ */
+int open_csim_trace(struct cache_sim *csim, struct trace_reader *r)
+{
+    if (open_trace(r, csim->trace_file) < 0)
+        return -1;
+    if (csim->marker_file)
+        set_marker_window(r, csim->marker_file);
+    return 0;
 }
 
-/* Return new cache set with E lines.
- * If E<0, then print error and return null
+/*
+ * read every record of the trace into memory, so benchmark times only
+ * the simulation itself
  */
-struct cache_set *new_cset(int E)
+struct access *load_trace(struct cache_sim *csim, size_t *n)
 {
-    if (E < 0)
+    struct trace_reader r;
+    size_t cap = 1 << 16;
+    struct access *trace;
+
+    *n = 0;
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
+
+    // a packed header tells how many records follow
+    if (r.count >= cap)
+        cap = r.count + 1;
+    trace = malloc(cap * sizeof(struct access));
+
+    while (next_record(&r, &trace[*n]))
     {
-        printf("Illegal argument");
-        return NULL;
+        if (++(*n) == cap)
+        {
+            cap *= 2;
+            trace = realloc(trace, cap * sizeof(struct access));
+        }
     }
-    int i;
-    struct cache_set *cset = (struct cache_set *)malloc(sizeof(struct cache_set));
-    struct cache_line *head = (struct cache_line *)malloc(sizeof(struct cache_line));
-    struct cache_line *tail = (struct cache_line *)malloc(sizeof(struct cache_line));
+    close_trace(&r);
+    return trace;
+}
 
-    head->prev = NULL;
-    head->next = tail;
+/*
+ * decode the whole trace without simulating it and report parse throughput
+ */
+void measure_parse(struct cache_sim *csim)
+{
+    struct trace_reader r;
+    struct access rec;
+    struct timespec start, end;
+    long records = 0;
+    double bytes;
+
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
 
-    tail->prev = head;
-    tail->next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (next_record(&r, &rec))
+        records++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-    cset->E = E;
-    cset->head = head;
-    cset->tail = tail;
+    bytes = r.bytes;
+    close_trace(&r);
 
-    for (i = 0; i < E; i++)
-        add_cline(cset);
-    return cset;
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("parse: %ld records, %.1f MB in %.3fs, %.1f MB/s\n",
+           records, bytes / 1e6, secs, bytes / 1e6 / secs);
 }
 
-void add_cline(struct cache_set *cset)
+/*
+ * replay records already in memory, same semantics as simulate
+ */
+void replay(struct cache_sim *csim, const struct access *trace, size_t n)
 {
-    struct cache_line *curr_line = (struct cache_line *)malloc(sizeof(struct cache_line));
-    curr_line->valid = 0;
-    prepend_line(cset, curr_line);
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (trace[i].type)
+        {
+        case 'I':
+            if (csim->pf)
+                csim->pf->pc = trace[i].addr;
+            break;
+        case 'L':
+            cache_access(csim, trace[i].addr, trace[i].size, 0);
+            break;
+        case 'S':
+            cache_access(csim, trace[i].addr, trace[i].size, 1);
+            break;
+        case 'M':
+            cache_access(csim, trace[i].addr, trace[i].size, 0);
+            cache_access(csim, trace[i].addr, trace[i].size, 1);
+            break;
+        }
+    }
 }
 
-/* 
- * add an empty cline to the beginning of the given cache_set
+/*
+ * replay the trace with every tag-match kernel this cpu supports (or only
+ * the one forced by -k), then with every replacement policy, and report
+ * accesses per second for each run
  */
-void prepend_line(struct cache_set *cset, struct cache_line *cline)
+void benchmark(struct cache_sim *csim)
 {
-    struct cache_line *head = cset->head;
-    struct cache_line *head_next = head->next;
+    size_t n;
+    struct access *trace = load_trace(csim, &n);
+    find_fn find = csim->find;
+    const struct repl_policy *policy = csim->policy;
+
+    for (int i = 0; i < num_kernels; i++)
+    {
+        const struct tag_kernel *kernel = &tag_kernels[i];
+
+        if (kernel->supported && !kernel->supported())
+            continue;
+        if (csim->kernel_name && strcmp(csim->kernel_name, kernel->name))
+            continue;
+
+        csim->find = kernel->find;
+        time_replay(csim, trace, n, "kernel", kernel->name);
+    }
+    csim->find = find;
 
-    cline->prev = head;
-    cline->next = head_next;
+    for (int i = 0; i < num_policies; i++)
+    {
+        // tree-PLRU can't run on a non power of two E
+        if (repl_policies[i].pow2_only && (csim->E & (csim->E - 1)))
+            continue;
+        csim->policy = &repl_policies[i];
+        time_replay(csim, trace, n, "policy", repl_policies[i].name);
+    }
 
-    head->next = cline;
-    head_next->prev = cline;
+    // leave the selected configuration's counts for the summary
+    csim->policy = policy;
+    reset_cache(csim);
+    replay(csim, trace, n);
+    free(trace);
 }
 
-/* 
- * remove a given cline when the cset is not NULL
+/*
+ * replay the trace on an empty cache and report its throughput
  */
-void remove_line(struct cache_line *cline)
+void time_replay(struct cache_sim *csim, const struct access *trace, size_t n,
+                 const char *what, const char *name)
 {
-    struct cache_line *next_cline = cline->next;
-    struct cache_line *prev_cline = cline->prev;
-    prev_cline->next = next_cline;
-    next_cline->prev = prev_cline;
+    struct timespec start, end;
+
+    reset_cache(csim);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    replay(csim, trace, n);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long accesses = csim->hit_count + csim->miss_count;
+    printf("%-6s %-8s %ld accesses in %.3fs, %.2f M accesses/s\n",
+           what, name, accesses, secs, accesses / secs / 1e6);
 }
 
-struct cache_sim *new_csim(void)
+/*
+ * replay the trace once, feeding every cache of the -S sweep from the same
+ * decoded batch of records, then print a row per (s, E, b)
+ */
+void sweep(struct cache_sim *csim)
 {
-    struct cache_sim *csim = calloc(1, sizeof(struct cache_sim)); // set all in csim to zero
-    return csim;
+    int values[3][MAX_SWEEP_VALUES]; // s, E and b values to combine
+    int counts[3] = {0, 0, 0};
+    int num_caches;
+    struct cache_sim **caches;
+    struct trace_reader r;
+    struct access *batch;
+    size_t n;
+
+    if (parse_sweep(csim->sweep_spec, values, counts) < 0)
+    {
+        printf("Bad sweep spec: %s\n", csim->sweep_spec);
+        exit(1);
+    }
+
+    // parameters missing from the spec come from -s, -E and -b
+    int fixed[3] = {csim->s, csim->E, csim->b};
+    for (int k = 0; k < 3; k++)
+    {
+        if (!counts[k])
+            values[k][counts[k]++] = fixed[k];
+    }
+    if (values[1][0] <= 0 || !csim->trace_file)
+    {
+        print_help();
+        exit(1);
+    }
+
+    num_caches = counts[0] * counts[1] * counts[2];
+    caches = malloc(num_caches * sizeof(struct cache_sim *));
+    for (int i = 0; i < num_caches; i++)
+    {
+        struct cache_sim *c = new_csim();
+
+        c->s = values[0][i / (counts[1] * counts[2])];
+        c->E = values[1][i / counts[2] % counts[1]];
+        c->b = values[2][i % counts[2]];
+        c->kernel_name = csim->kernel_name;
+        c->policy_name = csim->policy_name;
+        c->write_through = csim->write_through;
+        c->no_write_allocate = csim->no_write_allocate;
+        setup_cache(c);
+        caches[i] = c;
+    }
+
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
+    batch = malloc(BATCH_RECORDS * sizeof(struct access));
+    do
+    {
+        for (n = 0; n < BATCH_RECORDS && next_record(&r, &batch[n]); n++)
+            ;
+        for (int i = 0; i < num_caches; i++)
+            replay(caches[i], batch, n);
+    } while (n == BATCH_RECORDS);
+    close_trace(&r);
+    free(batch);
+
+    printf("%4s %4s %4s %12s %12s %12s\n", "s", "E", "b", "hits", "misses", "evictions");
+    for (int i = 0; i < num_caches; i++)
+    {
+        struct cache_sim *c = caches[i];
+
+        printf("%4d %4d %4d %12ld %12ld %12ld\n", c->s, c->E, c->b,
+               c->hit_count, c->miss_count, c->eviction_count);
+        free_csim(c);
+    }
+    free(caches);
 }
 
-void simulate(struct cache_sim *csim)
+/*
+ * parse a sweep spec such as "s=1..10,E=1,2,4,8,b=4..6" into the values
+ * of s, E and b; a bare number or range belongs to the last key named
+ * return -1 if the spec is malformed
+ */
+int parse_sweep(const char *spec, int values[3][MAX_SWEEP_VALUES], int counts[3])
 {
-    FILE *f;
-    __uint64_t addr;
-    int size;
-    int verbose = csim->verbose;
-    char type;
+    const char *keys = "sEb";
+    const char *p = spec;
+    int key = -1;
 
-    f = fopen(csim->trace_file, "r");
+    while (*p)
+    {
+        char *end;
+        int lo, hi;
+
+        if (p[0] && p[1] == '=')
+        {
+            const char *k = strchr(keys, p[0]);
+            if (!k)
+                return -1;
+            key = k - keys;
+            p += 2;
+        }
+        if (key < 0)
+            return -1;
+
+        lo = strtol(p, &end, 10);
+        if (end == p)
+            return -1;
+        hi = lo;
+        p = end;
+        if (p[0] == '.' && p[1] == '.')
+        {
+            hi = strtol(p + 2, &end, 10);
+            if (end == p + 2 || hi < lo)
+                return -1;
+            p = end;
+        }
+
+        for (int v = lo; v <= hi; v++)
+        {
+            if (v < 0 || counts[key] == MAX_SWEEP_VALUES)
+                return -1;
+            values[key][counts[key]++] = v;
+        }
+
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * replay the trace with csim->threads workers, each owning a contiguous
+ * range of set indices. The calling thread decodes the trace and splits
+ * every batch by owner; since sets never interact, replaying each set's
+ * accesses in order gives exactly the serial totals.
+ */
+void parallel_simulate(struct cache_sim *csim)
+{
+    struct replay_pool pool;
+    struct replay_worker *workers;
+    struct trace_reader r;
+    struct access rec;
+    int S_bits = csim->s;
+    int threads = csim->threads;
+    int done = 0;
 
-    while (fscanf(f, " %c %lx,%d\n", &type, &addr, &size) > 0)
+    // no point in more workers than sets
+    if (threads > (1 << S_bits))
+        threads = 1 << S_bits;
+
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    for (int k = 0; k < REPLAY_BATCHES; k++)
+    {
+        struct replay_batch *batch = &pool.batches[k];
+
+        batch->parts = malloc(threads * sizeof(struct access *));
+        batch->counts = calloc(threads, sizeof(int));
+        for (int w = 0; w < threads; w++)
+            batch->parts[w] = malloc(BATCH_RECORDS * sizeof(struct access));
+        batch->seq = -1;
+        batch->pending = 0;
+        batch->last = 0;
+    }
+
+    // workers share the lines but keep their own counters and LRU clock
+    workers = malloc(threads * sizeof(struct replay_worker));
+    for (int w = 0; w < threads; w++)
+    {
+        workers[w].id = w;
+        workers[w].pool = &pool;
+        workers[w].csim = malloc(sizeof(struct cache_sim));
+        *workers[w].csim = *csim;
+        pthread_create(&workers[w].thread, NULL, replay_worker, &workers[w]);
+    }
+
+    for (long seq = 0; !done; seq++)
     {
-        if (verbose && type != 'I')
-            printf("%c %lx, %d", type, addr, size);
-        switch (type)
+        struct replay_batch *batch = &pool.batches[seq % REPLAY_BATCHES];
+        int n;
+
+        // wait for every worker to be done with the previous use of the slot
+        pthread_mutex_lock(&pool.lock);
+        while (batch->pending)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        memset(batch->counts, 0, threads * sizeof(int));
+        for (n = 0; n < BATCH_RECORDS && next_record(&r, &rec); n++)
         {
-        case 'L':
-        case 'S':
-            // a data store
-            cache_access(csim, addr, size);
-            break;
-        case 'M':
-            // a data modify
-            cache_access(csim, addr, size); // a data load
-            cache_access(csim, addr, size); // followed by a data store
-            break;
+            // set i belongs to worker i * threads / S
+            __uint64_t ci = (rec.addr >> csim->b) & (((__uint64_t)1 << S_bits) - 1);
+            int w = (ci * threads) >> S_bits;
+
+            batch->parts[w][batch->counts[w]++] = rec;
         }
-        if (verbose)
+        done = n < BATCH_RECORDS;
+
+        pthread_mutex_lock(&pool.lock);
+        batch->last = done;
+        batch->pending = threads;
+        batch->seq = seq;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    close_trace(&r);
+
+    for (int w = 0; w < threads; w++)
+    {
+        pthread_join(workers[w].thread, NULL);
+        csim->hit_count += workers[w].csim->hit_count;
+        csim->miss_count += workers[w].csim->miss_count;
+        csim->eviction_count += workers[w].csim->eviction_count;
+        csim->writeback_count += workers[w].csim->writeback_count;
+        csim->read_bytes += workers[w].csim->read_bytes;
+        csim->write_bytes += workers[w].csim->write_bytes;
+        free(workers[w].csim);
+    }
+    free(workers);
+
+    for (int k = 0; k < REPLAY_BATCHES; k++)
+    {
+        for (int w = 0; w < threads; w++)
+            free(pool.batches[k].parts[w]);
+        free(pool.batches[k].parts);
+        free(pool.batches[k].counts);
+    }
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+/*
+ * replay this worker's part of every batch until the last one
+ */
+void *replay_worker(void *arg)
+{
+    struct replay_worker *worker = arg;
+    struct replay_pool *pool = worker->pool;
+    int last = 0;
+
+    for (long seq = 0; !last; seq++)
+    {
+        struct replay_batch *batch = &pool->batches[seq % REPLAY_BATCHES];
+
+        pthread_mutex_lock(&pool->lock);
+        while (batch->seq != seq)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+
+        replay(worker->csim, batch->parts[worker->id], batch->counts[worker->id]);
+        last = batch->last;
+
+        pthread_mutex_lock(&pool->lock);
+        if (--batch->pending == 0)
+            pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+/*
+ * one pass of Mattson's stack algorithm over the trace: histogram the reuse
+ * distance of every access within its set, then derive hits, misses and
+ * evictions of the LRU cache for each E in 1..max_E from the histogram
+ */
+void analyze_reuse(struct cache_sim *csim)
+{
+    int max_E = csim->max_E;
+    long *hist = calloc(max_E + 1, sizeof(long)); // distances >= max_E share the last bin
+    long *filled = calloc(max_E + 1, sizeof(long)); // sets holding min(blocks, max_E) blocks
+    long accesses = 0, cold = 0;
+    struct reuse_tracker *rt;
+    struct trace_reader r;
+    struct access rec;
+
+    if (csim->s < 0 || csim->b < 0 || max_E < 0 || !csim->trace_file)
+    {
+        print_help();
+        exit(1);
+    }
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
+
+    rt = new_reuse_tracker(csim->s);
+    while (next_record(&r, &rec))
+    {
+        // a modify is a load followed by a store to the same block
+        int times = rec.type == 'M' ? 2 : (rec.type == 'L' || rec.type == 'S');
+
+        for (; times > 0; times--)
+        {
+            long d = reuse_distance(rt, rec.addr >> csim->b);
+
+            accesses++;
+            if (d < 0)
+                cold++;
+            else
+                hist[d < max_E ? d : max_E]++;
+        }
+    }
+    close_trace(&r);
+
+    for (size_t i = 0; i < ((size_t)1 << csim->s); i++)
+    {
+        unsigned int n = rt->sets[i].blocks;
+        filled[n < max_E ? n : max_E]++;
+    }
+
+    printf("s=%d b=%d: %ld accesses, %lu distinct blocks\n",
+           csim->s, csim->b, accesses, (unsigned long)rt->num_blocks);
+    printf("%4s %12s %12s %12s %10s\n", "E", "hits", "misses", "evictions", "miss-ratio");
+
+    // a reuse at distance d hits in every set of more than d lines
+    long misses = accesses - cold;
+    for (int E = 1; E <= max_E; E++)
+    {
+        long placed = 0; // misses that filled an empty line instead of evicting
+
+        misses -= hist[E - 1];
+        for (int n = 0; n <= max_E; n++)
+            placed += filled[n] * (n < E ? n : E);
+
+        printf("%4d %12ld %12ld %12ld %10.6f\n", E, accesses - (misses + cold),
+               misses + cold, misses + cold - placed,
+               accesses ? (double)(misses + cold) / accesses : 0.0);
+    }
+
+    free_reuse_tracker(rt);
+    free(hist);
+    free(filled);
+}
+
+struct reuse_tracker *new_reuse_tracker(int s)
+{
+    struct reuse_tracker *rt = calloc(1, sizeof(struct reuse_tracker));
+
+    rt->s = s;
+    rt->sets = calloc((size_t)1 << s, sizeof(struct reuse_set));
+    rt->cap_blocks = 1024;
+    rt->blocks = malloc(rt->cap_blocks * sizeof(struct reuse_block));
+    rt->index_mask = 2 * rt->cap_blocks - 1;
+    rt->index = calloc(rt->index_mask + 1, sizeof(unsigned int));
+    return rt;
+}
+
+void free_reuse_tracker(struct reuse_tracker *rt)
+{
+    for (size_t i = 0; i < ((size_t)1 << rt->s); i++)
+    {
+        free(rt->sets[i].tree);
+        free(rt->sets[i].owner);
+    }
+    free(rt->sets);
+    free(rt->blocks);
+    free(rt->index);
+    free(rt);
+}
+
+/* Add delta at time i of a Fenwick tree over cap times */
+static void fenwick_add(int *tree, unsigned int cap, unsigned int i, int delta)
+{
+    for (i++; i <= cap; i += i & -i)
+        tree[i - 1] += delta;
+}
+
+/* Return the number of bits set at times [0, i) */
+static long fenwick_prefix(const int *tree, unsigned int i)
+{
+    long sum = 0;
+
+    for (; i > 0; i -= i & -i)
+        sum += tree[i - 1];
+    return sum;
+}
+
+/*
+ * renumber the live times of a full set to [0, live) keeping their order,
+ * growing it so at least half of the times are free afterwards
+ */
+static void compact_reuse_set(struct reuse_tracker *rt, struct reuse_set *rs)
+{
+    unsigned int live = 0;
+
+    for (unsigned int t = 0; t < rs->time; t++)
+    {
+        if (rs->owner[t] == NO_OWNER)
+            continue;
+        rt->blocks[rs->owner[t]].time = live;
+        rs->owner[live++] = rs->owner[t];
+    }
+
+    if (2 * live >= rs->cap)
+    {
+        rs->cap = rs->cap ? 2 * rs->cap : 16;
+        rs->tree = realloc(rs->tree, rs->cap * sizeof(int));
+        rs->owner = realloc(rs->owner, rs->cap * sizeof(unsigned int));
+    }
+
+    // O(cap) build of the tree with exactly the first live bits set
+    memset(rs->tree, 0, rs->cap * sizeof(int));
+    for (unsigned int i = 1; i <= rs->cap; i++)
+    {
+        unsigned int parent = i + (i & -i);
+
+        rs->tree[i - 1] += i <= live;
+        if (parent <= rs->cap)
+            rs->tree[parent - 1] += rs->tree[i - 1];
+    }
+    rs->time = live;
+}
+
+/*
+ * return the index of block in the tracker, adding it if new and
+ * setting *is_new accordingly
+ */
+static unsigned int find_reuse_block(struct reuse_tracker *rt, __uint64_t block, int *is_new)
+{
+    size_t h = (block * 0x9e3779b97f4a7c15ull) >> 20;
+    unsigned int *slot;
+
+    for (h &= rt->index_mask; rt->index[h]; h = (h + 1) & rt->index_mask)
+    {
+        if (rt->blocks[rt->index[h] - 1].block == block)
+        {
+            *is_new = 0;
+            return rt->index[h] - 1;
+        }
+    }
+
+    *is_new = 1;
+    slot = &rt->index[h];
+    if (rt->num_blocks == rt->cap_blocks)
+    {
+        // keep the hash at most half full, rebuilding it from the block list
+        rt->cap_blocks *= 2;
+        rt->blocks = realloc(rt->blocks, rt->cap_blocks * sizeof(struct reuse_block));
+        rt->index_mask = 2 * rt->cap_blocks - 1;
+        free(rt->index);
+        rt->index = calloc(rt->index_mask + 1, sizeof(unsigned int));
+        for (size_t i = 0; i <= rt->num_blocks; i++)
+        {
+            __uint64_t b = i < rt->num_blocks ? rt->blocks[i].block : block;
+
+            h = ((b * 0x9e3779b97f4a7c15ull) >> 20) & rt->index_mask;
+            while (rt->index[h])
+                h = (h + 1) & rt->index_mask;
+            rt->index[h] = i + 1;
+        }
+    }
+    else
+        *slot = rt->num_blocks + 1;
+
+    rt->blocks[rt->num_blocks].block = block;
+    return rt->num_blocks++;
+}
+
+/*
+ * record a use of block, return the number of distinct blocks of its set
+ * used since its previous use, or -1 on its first use
+ */
+long reuse_distance(struct reuse_tracker *rt, __uint64_t block)
+{
+    struct reuse_set *rs = &rt->sets[block & (((__uint64_t)1 << rt->s) - 1)];
+    int is_new;
+    unsigned int i = find_reuse_block(rt, block, &is_new);
+    long d = -1;
+
+    if (is_new)
+        rs->blocks++;
+    else
+    {
+        unsigned int last = rt->blocks[i].time;
+
+        // every block seen in the set has exactly one bit, so the bits set
+        // after last are all of them minus those up to it
+        d = rs->blocks - fenwick_prefix(rs->tree, last + 1);
+        fenwick_add(rs->tree, rs->cap, last, -1);
+        rs->owner[last] = NO_OWNER;
+    }
+
+    if (rs->time == rs->cap)
+        compact_reuse_set(rt, rs);
+    fenwick_add(rs->tree, rs->cap, rs->time, 1);
+    rs->owner[rs->time] = i;
+    rt->blocks[i].time = rs->time++;
+    return d;
+}
+
+/*
+ * replay the trace through the multi-level hierarchy described by the -H
+ * config file, then print the counters of every level and the AMAT
+ */
+void simulate_hierarchy(struct cache_sim *csim)
+{
+    struct hierarchy *h = load_hierarchy(csim);
+    struct trace_reader r;
+    struct access rec;
+
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
+
+    while (next_record(&r, &rec))
+    {
+        // a modify is a load followed by a store to the same block
+        int times = rec.type == 'M' ? 2 : (rec.type == 'L' || rec.type == 'S');
+
+        if (csim->verbose && times)
+            printf("%c %lx, %d", rec.type, rec.addr, rec.size);
+        for (int i = 0; i < times; i++)
+            hierarchy_access(h, rec.addr, csim->verbose);
+        if (csim->verbose && times)
             printf("\n");
     }
-    fclose(f);
+    close_trace(&r);
+
+    printf("%-8s %12s %12s %12s %12s %10s\n",
+           "level", "hits", "misses", "evictions", "back-inval", "miss-ratio");
+    for (int i = 0; i < h->num_levels; i++)
+    {
+        struct cache_level *lv = &h->levels[i];
+        struct cache_sim *c = lv->cache;
+        long probes = c->hit_count + c->miss_count;
+
+        printf("%-8s %12ld %12ld %12ld %12ld %10.4f\n", lv->name,
+               c->hit_count, c->miss_count, c->eviction_count, lv->back_invalidations,
+               probes ? (double)c->miss_count / probes : 0.0);
+    }
+    printf("%-8s %12ld\n", "memory", h->mem_accesses);
+    printf("%ld accesses, %lu cycles, AMAT %.2f cycles\n", h->accesses,
+           (unsigned long)h->cycles, h->accesses ? (double)h->cycles / h->accesses : 0.0);
+
+    for (int i = 0; i < h->num_levels; i++)
+        free_csim(h->levels[i].cache);
+    free(h);
 }
 
 /*
- * simulate the process of accesing cache memory
+ * read a hierarchy config, one level per line from L1 down:
+ *
+ *   <name> <s> <E> <b> <latency> <inclusion> [<policy>]
+ *   memory <latency>
+ *
+ * where inclusion is "-" for L1, or inclusive, exclusive or nine relative to
+ * the levels above; blank lines and lines starting with '#' are ignored
  */
-void cache_access(struct cache_sim *csim, __uint64_t addr, int size)
+struct hierarchy *load_hierarchy(struct cache_sim *csim)
 {
-    int s = csim->s;
-    int b = csim->b;
-    int verbose = csim->verbose;
-    __uint64_t ci_mask = (1 << s) - 1;
-    __uint64_t ci = (addr >> b) & ci_mask;
-    __uint64_t ct = addr >> (s + b);
-    struct cache_set *cset = csim->cache[ci];
-    struct cache_line *cline = find_cline(cset, ct);
-    if (cline)
+    struct hierarchy *h = calloc(1, sizeof(struct hierarchy));
+    FILE *f = fopen(csim->hierarchy_file, "r");
+    char line[256];
+    int lineno = 0;
+
+    if (!f)
     {
-        if (verbose)
-            printf(" hit");
+        printf("Cannot open hierarchy config %s\n", csim->hierarchy_file);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        struct cache_level *lv = &h->levels[h->num_levels];
+        char name[sizeof(lv->name)], inclusion[16], policy[sizeof(lv->policy)];
+        int s, E, b, latency, fields;
 
-        // first remove then prepend, so the used cline will always at
-        // the beginning of cset, which is the last one for evictions
-        remove_line(cline);
-        prepend_line(cset, cline);
+        lineno++;
+        fields = sscanf(line, " %15s", name);
+        if (fields < 1 || name[0] == '#')
+            continue;
+        if (!strcmp(name, "memory"))
+        {
+            if (sscanf(line, " %*s %d", &h->mem_latency) != 1 || h->mem_latency < 0)
+                goto bad_line;
+            continue;
+        }
+
+        fields = sscanf(line, " %15s %d %d %d %d %15s %15s",
+                        name, &s, &E, &b, &latency, inclusion, policy);
+        if (fields < 6 || s <= 0 || E <= 0 || b <= 0 || latency < 0)
+            goto bad_line;
+        if (h->num_levels == MAX_LEVELS)
+        {
+            printf("%s:%d: at most %d levels are supported\n",
+                   csim->hierarchy_file, lineno, MAX_LEVELS);
+            exit(1);
+        }
+
+        if (!strcmp(inclusion, "-") && h->num_levels == 0)
+            lv->inclusion = INCL_NONE;
+        else if (!strcmp(inclusion, "inclusive") && h->num_levels > 0)
+            lv->inclusion = INCL_INCLUSIVE;
+        else if (!strcmp(inclusion, "exclusive") && h->num_levels > 0)
+            lv->inclusion = INCL_EXCLUSIVE;
+        else if (!strcmp(inclusion, "nine") && h->num_levels > 0)
+            lv->inclusion = INCL_NINE;
+        else
+            goto bad_line;
+
+        // victims and back-invalidations move whole blocks between levels
+        if (h->num_levels > 0 && b != h->levels[0].cache->b)
+        {
+            printf("%s:%d: every level must have the same block size\n",
+                   csim->hierarchy_file, lineno);
+            exit(1);
+        }
 
-        (csim->hit_count)++;
+        strcpy(lv->name, name);
+        if (fields == 7)
+            strcpy(lv->policy, policy);
+        lv->latency = latency;
+        lv->cache = new_csim();
+        lv->cache->s = s;
+        lv->cache->E = E;
+        lv->cache->b = b;
+        lv->cache->kernel_name = csim->kernel_name;
+        lv->cache->policy_name = fields == 7 ? lv->policy : csim->policy_name;
+        setup_cache(lv->cache);
+        h->num_levels++;
+        continue;
+
+    bad_line:
+        printf("%s:%d: bad hierarchy line: %s", csim->hierarchy_file, lineno, line);
+        exit(1);
+    }
+    fclose(f);
+
+    if (!h->num_levels)
+    {
+        printf("%s: no cache levels\n", csim->hierarchy_file);
+        exit(1);
+    }
+    return h;
+}
+
+/*
+ * send one access down the hierarchy: probe the levels in order, paying
+ * each one's latency, until one hits or memory answers, then fill the
+ * levels that missed on the way back up
+ */
+void hierarchy_access(struct hierarchy *h, __uint64_t addr, int verbose)
+{
+    int k;
+
+    h->accesses++;
+    for (k = 0; k < h->num_levels; k++)
+    {
+        h->cycles += h->levels[k].latency;
+        if (cache_lookup(h->levels[k].cache, addr) >= 0)
+            break;
+    }
+
+    if (k == h->num_levels)
+    {
+        h->cycles += h->mem_latency;
+        h->mem_accesses++;
+        if (verbose)
+            printf(" memory");
     }
     else
-    { // if it's not a hit, then it's a miss
-        (csim->miss_count)++;
+    {
         if (verbose)
-            printf(" miss");
+            printf(" %s", h->levels[k].name);
+        // an exclusive level hands the block up instead of keeping a copy
+        if (k > 0 && h->levels[k].inclusion == INCL_EXCLUSIVE)
+            cache_invalidate(h->levels[k].cache, addr);
+    }
+
+    // exclusive levels are only filled by the victims of the level above
+    while (--k >= 0)
+    {
+        __uint64_t victim;
+
+        if (k > 0 && h->levels[k].inclusion == INCL_EXCLUSIVE)
+            continue;
+        if (cache_fill(h->levels[k].cache, addr, 0, &victim))
+            hierarchy_evict(h, k, victim);
+    }
+}
+
+/*
+ * handle a block evicted from level k: an inclusive level takes it out of
+ * every level above, and an exclusive level below catches it
+ */
+void hierarchy_evict(struct hierarchy *h, int k, __uint64_t victim)
+{
+    struct cache_level *lv = &h->levels[k];
+
+    if (lv->inclusion == INCL_INCLUSIVE)
+    {
+        for (int i = 0; i < k; i++)
+            lv->back_invalidations += cache_invalidate(h->levels[i].cache, victim);
+    }
+
+    if (k + 1 < h->num_levels && h->levels[k + 1].inclusion == INCL_EXCLUSIVE)
+    {
+        struct cache_sim *below = h->levels[k + 1].cache;
+        __uint64_t next_victim;
+
+        cache_invalidate(below, victim); // never keep two copies of the block
+        if (cache_fill(below, victim, 0, &next_victim))
+            hierarchy_evict(h, k + 1, next_victim);
+    }
+}
+
+/*
+ * replay the trace like simulate, charging the outcome of every access to
+ * the labelled region and the set it falls in, then write both tables as CSV
+ */
+void attribute(struct cache_sim *csim)
+{
+    struct attribution *at = load_labels(csim->label_file);
+    size_t S = (size_t)1 << csim->s;
+    __uint64_t *set_counts = calloc(S * ATTR_COUNTERS, sizeof(__uint64_t));
+    __uint64_t ci_mask = S - 1;
+    struct trace_reader r;
+    struct access rec;
+    int verbose = csim->verbose;
 
-        // cache current line
-        cline = get_cline(cset, ct);
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
 
-        // Eviction when cline is NULL(cache memory is full)
-        if (!cline)
+    while (next_record(&r, &rec))
+    {
+        // a modify is a load followed by a store to the same block
+        int times = rec.type == 'M' ? 2 : (rec.type == 'L' || rec.type == 'S');
+        __uint64_t *region = at->counts + find_region(at, rec.addr) * ATTR_COUNTERS;
+        __uint64_t *set = set_counts + ((rec.addr >> csim->b) & ci_mask) * ATTR_COUNTERS;
+
+        if (verbose && times)
+            printf("%c %lx, %d", rec.type, rec.addr, rec.size);
+        for (int i = 0; i < times; i++)
         {
-            if (verbose)
-                printf(" eviction");
+            long hits = csim->hit_count;
+            long misses = csim->miss_count;
+            long evictions = csim->eviction_count;
+
+            cache_access(csim, rec.addr, rec.size, rec.type == 'S' || i == 1);
 
-            cline = cset->tail->prev;
-            (csim->eviction_count)++;
+            // the counters moved by this access tell its outcome
+            hits = csim->hit_count - hits;
+            misses = csim->miss_count - misses;
+            evictions = csim->eviction_count - evictions;
+            region[0] += hits;
+            region[1] += misses;
+            region[2] += evictions;
+            set[0] += hits;
+            set[1] += misses;
+            set[2] += evictions;
         }
+        if (verbose && times)
+            printf("\n");
+    }
+    close_trace(&r);
 
-        // write cache info to new cache line
-        cline->valid = 1;
-        cline->tag = ct;
+    FILE *out = csim->csv_file ? fopen(csim->csv_file, "w") : stdout;
+    if (!out)
+    {
+        printf("Cannot create %s\n", csim->csv_file);
+        exit(1);
+    }
 
-        // first remove then prepend, so the used cline will always at
-        // the beginning of cset, which is the last one for evictions
-        remove_line(cline);
-        prepend_line(cset, cline);
+    fprintf(out, "kind,label,index,hits,misses,evictions\n");
+    for (int i = 0; i <= at->num_regions; i++)
+    {
+        // the last row holds the accesses that no label covers
+        struct region *rg = &at->regions[i];
+        const char *name = i < at->num_regions ? rg->name : "unlabelled";
+        int rows = i < at->num_regions ? rg->rows : 1;
+        __uint64_t total[ATTR_COUNTERS] = {0, 0, 0};
+
+        for (int k = 0; k < rows; k++)
+        {
+            __uint64_t *c = at->counts + (rg->first + k) * ATTR_COUNTERS;
+
+            for (int j = 0; j < ATTR_COUNTERS; j++)
+                total[j] += c[j];
+            if (rg->stride)
+                fprintf(out, "row,%s,%d,%lu,%lu,%lu\n", name, k,
+                        (unsigned long)c[0], (unsigned long)c[1], (unsigned long)c[2]);
+        }
+        fprintf(out, "region,%s,,%lu,%lu,%lu\n", name,
+                (unsigned long)total[0], (unsigned long)total[1], (unsigned long)total[2]);
     }
+    for (size_t i = 0; i < S; i++)
+    {
+        __uint64_t *c = set_counts + i * ATTR_COUNTERS;
+
+        fprintf(out, "set,,%lu,%lu,%lu,%lu\n", (unsigned long)i,
+                (unsigned long)c[0], (unsigned long)c[1], (unsigned long)c[2]);
+    }
+    if (out != stdout)
+        fclose(out);
+
+    free(set_counts);
+    free(at->regions);
+    free(at->counts);
+    free(at);
 }
 
 /*
- * return valid cache line in a given cache set
- * return NULL if not find or cache line not valid
+ * read a labels file, one address range per line:
+ *
+ *   <name> <start> <end> [<stride>]
+ *
+ * start and end are hex, end is exclusive; a stride in bytes splits the
+ * range into rows counted apart. Blank lines and '#' lines are ignored.
  */
-struct cache_line *find_cline(struct cache_set *cset, __uint64_t ct)
+struct attribution *load_labels(const char *label_file)
 {
-    struct cache_line *curr_line = cset->head->next;
-    struct cache_line *tail = cset->tail;
+    struct attribution *at = calloc(1, sizeof(struct attribution));
+    FILE *f = fopen(label_file, "r");
+    char line[256];
+    int lineno = 0;
+    int cap = 8;
+    int rows = 0;
 
-    while (curr_line != tail)
+    if (!f)
     {
-        if (curr_line->valid && curr_line->tag == ct)
-            return curr_line;
+        printf("Cannot open labels file %s\n", label_file);
+        exit(1);
+    }
+
+    // one spare region holds the counters of unlabelled accesses
+    at->regions = calloc(cap + 1, sizeof(struct region));
+    while (fgets(line, sizeof(line), f))
+    {
+        struct region *rg = &at->regions[at->num_regions];
+        unsigned long start, end, stride = 0;
+        char name[sizeof(rg->name)];
+        int fields;
+
+        lineno++;
+        fields = sscanf(line, " %31s %lx %lx %lu", name, &start, &end, &stride);
+        if (fields < 1 || name[0] == '#')
+            continue;
+        if (fields < 3 || end <= start)
+        {
+            printf("%s:%d: bad label line: %s", label_file, lineno, line);
+            exit(1);
+        }
+        if (stride && (end - start - 1) / stride >= MAX_REGION_ROWS)
+        {
+            printf("%s:%d: more than %d rows in %s\n", label_file, lineno, MAX_REGION_ROWS, name);
+            exit(1);
+        }
 
-        curr_line = curr_line->next;
+        strcpy(rg->name, name);
+        rg->start = start;
+        rg->end = end;
+        rg->stride = stride;
+        rg->rows = stride ? (end - start + stride - 1) / stride : 1;
+        rows += rg->rows;
+        if (++at->num_regions == cap)
+        {
+            cap *= 2;
+            at->regions = realloc(at->regions, (cap + 1) * sizeof(struct region));
+        }
     }
+    fclose(f);
 
-    return NULL;
+    // regions are searched by start address, so they must not overlap
+    qsort(at->regions, at->num_regions, sizeof(struct region), cmp_region);
+    for (int i = 0; i < at->num_regions; i++)
+    {
+        if (i > 0 && at->regions[i].start < at->regions[i - 1].end)
+        {
+            printf("%s: labels %s and %s overlap\n", label_file,
+                   at->regions[i - 1].name, at->regions[i].name);
+            exit(1);
+        }
+        at->regions[i].first = i > 0 ? at->regions[i - 1].first + at->regions[i - 1].rows : 0;
+    }
+    memset(&at->regions[at->num_regions], 0, sizeof(struct region));
+    at->regions[at->num_regions].first = rows;
+    at->counts = calloc((rows + 1) * ATTR_COUNTERS, sizeof(__uint64_t));
+    return at;
+}
+
+static int cmp_region(const void *a, const void *b)
+{
+    const struct region *x = a, *y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/*
+ * return the counter row of addr: a binary search for the last region
+ * starting at or below it, then the row inside that region
+ */
+int find_region(struct attribution *at, __uint64_t addr)
+{
+    const struct region *rg = &at->regions[at->last];
+    int lo = 0, hi = at->num_regions;
+
+    // runs of accesses mostly stay in one array
+    if (addr - rg->start < rg->end - rg->start)
+        return rg->first + (rg->stride ? (addr - rg->start) / rg->stride : 0);
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (at->regions[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0 || addr >= at->regions[lo - 1].end)
+        return at->regions[at->num_regions].first;
+
+    at->last = lo - 1;
+    rg = &at->regions[lo - 1];
+    return rg->first + (rg->stride ? (addr - rg->start) / rg->stride : 0);
 }
 
 /*
- * return an unused(invalid) line for miss case
+ * replay the trace like simulate, sorting every miss into the three Cs with
+ * a shadow fully associative LRU cache of the same capacity: a block never
+ * seen before is a cold miss, one the shadow cache misses too is a capacity
+ * miss, and one it would have hit is a conflict miss
  */
-struct cache_line *get_cline(struct cache_set *cset, __uint64_t ct)
+void classify_misses(struct cache_sim *csim)
 {
-    struct cache_line *curr_line = cset->head->next;
-    struct cache_line *tail = cset->tail;
+    // a single set makes the reuse tracker one LRU stack over every block
+    struct reuse_tracker *shadow = new_reuse_tracker(0);
+    long capacity = ((long)1 << csim->s) * csim->E;
+    struct trace_reader r;
+    struct access rec;
+    int verbose = csim->verbose;
+
+    if (open_csim_trace(csim, &r) < 0)
+        exit(1);
 
-    while (curr_line != tail)
+    while (next_record(&r, &rec))
     {
-        // return an unused(invalid) line
-        // so that data in valid lines won't lose
-        if (!curr_line->valid)
+        // a modify is a load followed by a store to the same block
+        int times = rec.type == 'M' ? 2 : (rec.type == 'L' || rec.type == 'S');
+
+        if (verbose && times)
+            printf("%c %lx, %d", rec.type, rec.addr, rec.size);
+        for (int i = 0; i < times; i++)
         {
-            return curr_line;
+            long misses = csim->miss_count;
+            long d = reuse_distance(shadow, rec.addr >> csim->b);
+
+            cache_access(csim, rec.addr, rec.size, rec.type == 'S' || i == 1);
+            if (csim->miss_count == misses)
+                continue;
+
+            if (d < 0)
+                csim->cold_misses++;
+            else if (d >= capacity)
+                csim->capacity_misses++;
+            else
+                csim->conflict_misses++;
+            if (verbose)
+                printf(d < 0 ? " (cold)" : d >= capacity ? " (capacity)" : " (conflict)");
         }
-        curr_line = curr_line->next; // find the next unused line
+        if (verbose && times)
+            printf("\n");
     }
-    return NULL;
+    close_trace(&r);
+    free_reuse_tracker(shadow);
 }
 
 struct cache_sim *cache_init(int argc, char *argv[])
 {
     struct cache_sim *csim = new_csim();
     extern char *optarg;
-    char opt;
+    int opt;
     char *trace_name;
+    static const struct option long_opts[] = {
+        {"window-from-marker", optional_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0},
+    };
 
-    while ((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1)
+    while ((opt = getopt_long(argc, argv, "hvBPCk:R:S:D:j:H:W:A:o:p:s:E:b:t:", long_opts, NULL)) != -1)
     {
         switch (opt)
         {
+        case 'w':
+            csim->marker_file = optarg ? optarg : ".marker";
+            break;
         case 'h':
             print_help();
             exit(1);
         case 'v':
             csim->verbose = 1;
             break;
+        case 'B':
+            csim->bench = 1;
+            break;
+        case 'P':
+            csim->parse_bench = 1;
+            break;
+        case 'C':
+            csim->classify = 1;
+            break;
+        case 'k':
+            csim->kernel_name = optarg;
+            break;
+        case 'R':
+            csim->policy_name = optarg;
+            break;
+        case 'S':
+            csim->sweep_spec = optarg;
+            break;
+        case 'D':
+            csim->max_E = atoi(optarg);
+            break;
+        case 'j':
+            csim->threads = atoi(optarg);
+            break;
+        case 'H':
+            csim->hierarchy_file = optarg;
+            break;
+        case 'A':
+            csim->label_file = optarg;
+            break;
+        case 'o':
+            csim->csv_file = optarg;
+            break;
+        case 'p':
+            if (parse_prefetcher(csim, optarg) < 0)
+            {
+                printf("Bad prefetcher: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'W':
+            if (parse_write_policy(csim, optarg) < 0)
+            {
+                printf("Bad write policy: %s\n", optarg);
+                exit(1);
+            }
+            csim->write_report = 1;
+            break;
         case 's':
             csim->s = atoi(optarg);
+            break;
         case 'E':
             csim->E = atoi(optarg);
             break;
@@ -330,50 +1504,137 @@ struct cache_sim *cache_init(int argc, char *argv[])
             break;
         }
     }
+    // every mode replays a trace
+    if (!csim->trace_file)
+    {
+        printf("Missing -t <file>\n");
+        exit(1);
+    }
+    // the parse benchmark reads the trace twice, a pipe can only be read once
+    if (csim->parse_bench && csim->trace_file && !strcmp(csim->trace_file, "-"))
+    {
+        printf("-P needs a trace file, not stdin\n");
+        exit(1);
+    }
+    // each of these replays the trace its own way
+    if (csim->label_file && csim->classify)
+    {
+        printf("-A and -C can't be combined\n");
+        exit(1);
+    }
+    // the replay threads neither print accesses in order nor prefetch
+    if (csim->threads > 1 && (csim->verbose || csim->prefetcher))
+    {
+        printf("-j can't be combined with -v or -p\n");
+        exit(1);
+    }
+    // only the plain replay is split across threads
+    if (csim->threads > 1 && (csim->label_file || csim->classify || csim->bench ||
+                              csim->sweep_spec || csim->max_E || csim->hierarchy_file))
+    {
+        printf("-j can't be combined with -A, -B, -C, -S, -D or -H\n");
+        exit(1);
+    }
+    // the sweep, reuse and hierarchy caches don't prefetch
+    if (csim->prefetcher && (csim->sweep_spec || csim->max_E || csim->hierarchy_file))
+    {
+        printf("-p can't be combined with -S, -D or -H\n");
+        exit(1);
+    }
+    // reuse distances and hierarchy levels assume write-back, write-allocate caches
+    if (csim->write_report && (csim->max_E || csim->hierarchy_file))
+    {
+        printf("-W can't be combined with -D or -H\n");
+        exit(1);
+    }
 
     return csim;
 }
 
+/*
+ * report how the prefetched lines were used: accuracy is the share of
+ * prefetches a demand access hit before eviction, coverage the share of
+ * would-be misses they removed, and unused lines evicted are pollution
+ */
+void print_prefetch(struct cache_sim *csim)
+{
+    long issued = csim->prefetch_issued;
+    long useful = csim->prefetch_useful;
+
+    printf("prefetch %s:%d: issued:%ld useful:%ld evicted-unused:%ld accuracy:%.4f coverage:%.4f\n",
+           csim->prefetcher->name, csim->pf->degree, issued, useful, csim->prefetch_unused,
+           issued ? (double)useful / issued : 0.0,
+           useful + csim->miss_count ? (double)useful / (useful + csim->miss_count) : 0.0);
+}
+
+/*
+ * print the writebacks and the bytes moved to and from memory; lines still
+ * dirty at the end of the trace are counted apart, they were never written
+ */
+void print_traffic(struct cache_sim *csim)
+{
+    size_t lines = ((size_t)1 << csim->s) * csim->E;
+    int dirty_left = 0;
+
+    for (size_t i = 0; i < lines; i++)
+        dirty_left += csim->flags[i] & LINE_DIRTY;
+
+    printf("%s,%s: writebacks:%ld dirty:%d read-bytes:%lu write-bytes:%lu\n",
+           csim->write_through ? "wt" : "wb", csim->no_write_allocate ? "nwa" : "wa",
+           csim->writeback_count, dirty_left,
+           (unsigned long)csim->read_bytes, (unsigned long)csim->write_bytes);
+}
+
 void print_help(void)
 {
-    printf("Usage: ./csim [-hv] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("Usage: ./csim [-hvBPC] [-k <kernel>] [-R <policy>] [-W <policy>] [-p <prefetcher>] [-j <num>] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("       ./csim -S <spec> [-s <num>] [-E <num>] [-b <num>] -t <file>\n");
+    printf("       ./csim -D <num> -s <num> -b <num> -t <file>\n");
+    printf("       ./csim -H <config> [-v] [-R <policy>] -t <file>\n");
+    printf("       ./csim -A <labels> [-o <csv>] -s <num> -E <num> -b <num> -t <file>\n");
     printf("Options:\n");
     printf("  -h              Print this help message.\n");
     printf("  -v              Optional verbose flag.\n");
+    printf("  -B              Benchmark every tag-match kernel and policy on the trace.\n");
+    printf("  -P              Report trace parse throughput in MB/s.\n");
+    printf("  -C              Split misses into cold, capacity and conflict misses;\n");
+    printf("                  not with -A.\n");
+    printf("  -k <kernel>     Force a tag-match kernel: avx2, sse4.2 or scalar.\n");
+    printf("  -R <policy>     Replacement policy: lru (default), fifo, random, lfu,\n");
+    printf("                  plru, bitplru, srrip or brrip.\n");
+    printf("  -A <labels>     Attribute hits, misses and evictions to the labelled address\n");
+    printf("                  ranges, their rows and every set, written as CSV.\n");
+    printf("  -o <csv>        File for the -A CSV instead of stdout.\n");
+    printf("  -W <policy>     Write policy wb or wt, and wa or nwa, e.g. wt,nwa;\n");
+    printf("                  also reports writebacks and memory traffic.\n");
+    printf("  -p <prefetcher> Prefetch with next[:N], stride[:N] or stream[:N], N blocks\n");
+    printf("                  per trigger, and report accuracy, coverage and pollution.\n");
+    printf("  -S <spec>       Sweep every (s,E,b) in spec over one pass of the trace.\n");
+    printf("  -j <num>        Replay with num threads, each owning a range of sets;\n");
+    printf("                  only for a plain replay, not with -v or -p.\n");
+    printf("  -D <num>        Print LRU miss-ratio curve for E = 1..num from reuse distances.\n");
+    printf("  -H <config>     Simulate the multi-level hierarchy in config and report AMAT.\n");
     printf("  -s <num>        Number of set index bits.\n");
     printf("  -E <num>        Number of lines per set.\n");
     printf("  -b <num>        Number of block offset bits.\n");
-    printf("  -t <tracefile>  Name of the valgrind trace to replay.\n\n");
+    printf("  -t <tracefile>  Name of the valgrind trace to replay, - for stdin.\n");
+    printf("  --window-from-marker[=<file>]\n");
+    printf("                  Only replay the data accesses between the start and end\n");
+    printf("                  markers tracegen writes to file (default .marker).\n\n");
     printf("Examples:\n");
     printf("  linux>  ./csim -s 4 -E 1 -b 4 -t traces/yi.trace\n");
     printf("  linux>  ./csim -v -s 4 -E 1 -b 4 -t traces/yi.trace\n");
+    printf("  linux>  ./csim -B -s 4 -E 64 -b 6 -t traces/long.trace\n");
+    printf("  linux>  ./csim -S s=1..10,E=1,2,4,8,b=4..6 -t traces/long.trace\n");
+    printf("  linux>  ./csim -C -s 5 -E 1 -b 5 -t traces/trans.trace\n");
+    printf("  linux>  ./csim -R srrip -s 6 -E 16 -b 6 -t traces/long.trace\n");
+    printf("  linux>  ./csim -W wb,nwa -s 6 -E 8 -b 6 -t traces/long.trace\n");
+    printf("  linux>  ./csim -p stream:4 -s 6 -E 8 -b 6 -t traces/long.trace\n");
+    printf("  linux>  ./csim -j 8 -s 10 -E 16 -b 6 -t traces/long.trace\n");
+    printf("  linux>  ./csim -D 64 -s 4 -b 5 -t traces/long.trace\n");
+    printf("  linux>  ./csim -H hierarchy.cfg -t traces/long.trace\n");
+    printf("  linux>  ./csim -A .regions -o misses.csv -s 5 -E 1 -b 5 -t trace.f0\n");
+    printf("  linux>  valgrind --tool=lackey --trace-mem=yes --log-fd=1 ./tracegen -M 32 -N 32 -F 0 \\\n");
+    printf("              | ./csim -s 5 -E 1 -b 5 -t - --window-from-marker\n");
 }
 
-void free_csim(struct cache_sim *csim)
-{
-    int i;
-    int S = 1 << (csim->s); // S = 2^s cache sets in cache_sim
-    for (i = 0; i < S; i++)
-    {
-        free_cset(csim->cache[i]); // free all lines in each cset
-    }
-    free(csim->cache); // free all sets in csim
-    free(csim);
-}
-
-/*
- * free all lines in the given cset
- */
-void free_cset(struct cache_set *cset)
-{
-    struct cache_line *curr_line = cset->head;
-    struct cache_line *next_line;
-
-    while (curr_line)
-    {
-        next_line = curr_line->next; // saving before free to prevent losing line pointer
-        free(curr_line);
-        curr_line = next_line;
-    }
-    free(cset);
-}
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*
+ * libcsim.c - The library interface to the cache model in cache.c
+ *
+ * A csim_t is a cache_sim configured from a csim_config instead of the
+ * command line. Every check csim does on its options is repeated here but
+ * reported through the return value, since a library must not exit.
+ */
+
+#include "libcsim.h"
+#include "cache.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define MAX_CACHE_LINES ((size_t)1 << 40) // keeps the slab size from overflowing
+#define BATCH_STORE_SIZE 8 // bytes a store sends to memory, batches carry no sizes
+
+static int configure(struct cache_sim *csim, const struct csim_config *cfg,
+                     char *err, size_t err_len);
+
+int csim_check_config(const struct csim_config *cfg, char *err, size_t err_len)
+{
+    if (cfg->s < 0 || cfg->E <= 0 || cfg->b < 0 || cfg->s + cfg->b >= 64)
+    {
+        snprintf(err, err_len, "Invalid cache shape s=%d E=%d b=%d", cfg->s, cfg->E, cfg->b);
+        return -1;
+    }
+    if (cfg->s >= 40 || ((size_t)1 << cfg->s) > MAX_CACHE_LINES / cfg->E)
+    {
+        snprintf(err, err_len, "Cache of 2^%d sets of %d lines is too large", cfg->s, cfg->E);
+        return -1;
+    }
+    if (cfg->prefetcher && check_prefetcher(cfg->prefetcher) < 0)
+    {
+        snprintf(err, err_len, "Unknown prefetcher: %s", cfg->prefetcher);
+        return -1;
+    }
+    return check_policies(cfg->kernel, cfg->policy, cfg->E, err, err_len);
+}
+
+csim_t *csim_create(const struct csim_config *cfg)
+{
+    struct cache_sim *csim = new_csim();
+    char err[128];
+
+    if (csim && configure(csim, cfg, err, sizeof(err)) < 0)
+    {
+        free_csim(csim);
+        return NULL;
+    }
+    return csim;
+}
+
+/*
+ * copy cfg into csim and allocate its lines
+ * return -1 with the reason in err if the cache can't be built
+ */
+static int configure(struct cache_sim *csim, const struct csim_config *cfg,
+                     char *err, size_t err_len)
+{
+    if (csim_check_config(cfg, err, err_len) < 0)
+        return -1;
+    if (cfg->prefetcher && parse_prefetcher(csim, cfg->prefetcher) < 0)
+    {
+        snprintf(err, err_len, "Out of memory");
+        return -1;
+    }
+
+    csim->s = cfg->s;
+    csim->E = cfg->E;
+    csim->b = cfg->b;
+    csim->policy_name = (char *)cfg->policy;
+    csim->kernel_name = (char *)cfg->kernel;
+    csim->write_through = cfg->write_through;
+    csim->no_write_allocate = cfg->no_write_allocate;
+    return alloc_cache(csim, err, err_len);
+}
+
+size_t csim_access_batch(csim_t *sim, const uint64_t *addrs, const uint8_t *ops, size_t n)
+{
+    size_t skipped = 0;
+
+    if (!ops)
+    {
+        for (size_t i = 0; i < n; i++)
+            cache_access(sim, addrs[i], BATCH_STORE_SIZE, 0);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (ops[i])
+        {
+        case 'I':
+            // the data accesses that follow belong to this instruction
+            if (sim->pf)
+                sim->pf->pc = addrs[i];
+            break;
+        case 'L':
+            cache_access(sim, addrs[i], BATCH_STORE_SIZE, 0);
+            break;
+        case 'S':
+            cache_access(sim, addrs[i], BATCH_STORE_SIZE, 1);
+            break;
+        case 'M':
+            cache_access(sim, addrs[i], BATCH_STORE_SIZE, 0);
+            cache_access(sim, addrs[i], BATCH_STORE_SIZE, 1);
+            break;
+        default:
+            skipped++;
+        }
+    }
+    return skipped;
+}
+
+void csim_stats(const csim_t *sim, struct csim_stats *stats)
+{
+    stats->hits = sim->hit_count;
+    stats->misses = sim->miss_count;
+    stats->evictions = sim->eviction_count;
+    stats->writebacks = sim->writeback_count;
+    stats->read_bytes = sim->read_bytes;
+    stats->write_bytes = sim->write_bytes;
+    stats->prefetch_issued = sim->prefetch_issued;
+    stats->prefetch_useful = sim->prefetch_useful;
+    stats->prefetch_unused = sim->prefetch_unused;
+}
+
+void csim_reset(csim_t *sim)
+{
+    reset_cache(sim);
+}
+
+void csim_destroy(csim_t *sim)
+{
+    if (sim)
+        free_csim(sim);
+}
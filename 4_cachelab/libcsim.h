@@ -0,0 +1,72 @@
+/*
+ * libcsim.h - Embed the csim cache model in another program
+ *
+ * Build with "make libcsim.a" and link the archive. Unlike csim, nothing
+ * in the library prints or exits: a bad configuration makes csim_create
+ * return NULL, and csim_check_config says why.
+ *
+ *   struct csim_config cfg = {.s = 5, .E = 1, .b = 5};
+ *   csim_t *sim = csim_create(&cfg);
+ *   csim_access_batch(sim, addrs, ops, n);
+ *   csim_stats(sim, &stats);
+ *   csim_destroy(sim);
+ */
+
+#ifndef CSIM_LIBCSIM_H
+#define CSIM_LIBCSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct cache_sim csim_t;
+
+/* Shape and policies of a simulated cache; NULL policy, kernel and prefetcher take the csim defaults */
+struct csim_config
+{
+    int s; // 2^s sets
+    int E; // lines per set
+    int b; // 2^b bytes per block
+    const char *policy;     // replacement policy as for -R, NULL is LRU
+    const char *kernel;     // tag-match kernel as for -k, NULL picks the widest
+    const char *prefetcher; // prefetcher as for -p, NULL for none
+    int write_through;      // stores go straight to memory instead of dirtying lines
+    int no_write_allocate;  // store misses bypass the cache
+};
+
+/* Counters accumulated since csim_create or the last csim_reset */
+struct csim_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;  // dirty lines written back on eviction
+    uint64_t read_bytes;  // bytes fetched from memory by fills
+    uint64_t write_bytes; // bytes written to memory by writebacks and stores
+    uint64_t prefetch_issued;
+    uint64_t prefetch_useful;
+    uint64_t prefetch_unused;
+};
+
+/* Return 0 if cfg describes a cache csim_create can build, else -1 with the reason in err */
+int csim_check_config(const struct csim_config *cfg, char *err, size_t err_len);
+
+/* Build an empty cache, NULL if cfg is invalid or memory runs out */
+csim_t *csim_create(const struct csim_config *cfg);
+
+/*
+ * Replay n accesses in order. ops holds the valgrind op of each access,
+ * 'L', 'S', 'M' or 'I' as in a trace; an 'I' only tells the stride
+ * prefetcher which instruction the following accesses belong to. A NULL
+ * ops replays every address as a load. Return the number of accesses
+ * skipped for an unknown op.
+ */
+size_t csim_access_batch(csim_t *sim, const uint64_t *addrs, const uint8_t *ops, size_t n);
+
+void csim_stats(const csim_t *sim, struct csim_stats *stats);
+
+/* Empty the cache and clear its counters, keeping the configuration */
+void csim_reset(csim_t *sim);
+
+void csim_destroy(csim_t *sim);
+
+#endif /* CSIM_LIBCSIM_H */
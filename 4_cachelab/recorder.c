@@ -0,0 +1,182 @@
+/*
+ * recorder.c - ThreadSanitizer hooks that record accesses for tracegen-native
+ *
+ * Only the entry points gcc emits for plain C code are provided: sized and
+ * unaligned loads and stores, memory ranges, and the function entry, exit
+ * and init calls, which have nothing to record.
+ */
+
+#include "recorder.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define RECORD_STACK_SPAN ((uint64_t)64 << 20) // deepest stack a transpose is expected to use
+#define RECORD_MIN_CAP 4096
+
+/* The accesses of a thread other than the recording one, merged at record_stop */
+struct thread_log
+{
+    struct recording rec;
+    int lost;
+    struct thread_log *next;
+};
+
+/*
+ * Set by the recording thread before and after the code it records, so
+ * any worker thread that code starts sees them without a lock
+ */
+static struct recording *recording; // NULL when not recording
+static uint64_t stack_top;          // frame passed to record_start
+static unsigned generation;         // counts record_start calls
+static int lost;
+
+static pthread_mutex_t logs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_log *logs, **logs_tail = &logs; // in the order threads first recorded
+
+static __thread int recording_here;          // this thread called record_start
+static __thread struct thread_log *thread_log; // valid if thread_generation is current
+static __thread unsigned thread_generation;
+
+/* Append an access to rec; return -1 if it couldn't grow and the access was lost */
+static int append(struct recording *rec, uint64_t addr, uint8_t op)
+{
+    if (rec->n == rec->cap)
+    {
+        size_t cap = rec->cap ? rec->cap * 2 : RECORD_MIN_CAP;
+        uint64_t *addrs = realloc(rec->addrs, cap * sizeof(uint64_t));
+        uint8_t *ops = addrs ? realloc(rec->ops, cap) : NULL;
+
+        if (addrs)
+            rec->addrs = addrs;
+        if (!ops)
+            return -1;
+        rec->ops = ops;
+        rec->cap = cap;
+    }
+    rec->addrs[rec->n] = addr;
+    rec->ops[rec->n] = op;
+    rec->n++;
+    return 0;
+}
+
+/* The log of the calling worker thread for this recording, NULL if out of memory */
+static struct thread_log *worker_log(void)
+{
+    struct thread_log *log;
+
+    if (thread_generation == generation)
+        return thread_log;
+
+    log = calloc(1, sizeof(*log));
+    if (log)
+    {
+        pthread_mutex_lock(&logs_lock);
+        *logs_tail = log;
+        logs_tail = &log->next;
+        pthread_mutex_unlock(&logs_lock);
+    }
+    thread_log = log;
+    thread_generation = generation;
+    return log;
+}
+
+void record_start(struct recording *rec, const void *frame)
+{
+    rec->n = 0;
+    stack_top = (uintptr_t)frame;
+    lost = 0;
+    generation++;
+    recording_here = 1;
+    recording = rec;
+}
+
+int record_stop(void)
+{
+    struct recording *rec = recording;
+    struct thread_log *log, *next;
+
+    recording = NULL;
+    recording_here = 0;
+
+    // the workers have been joined, so their logs are complete
+    pthread_mutex_lock(&logs_lock);
+    for (log = logs; log; log = next)
+    {
+        next = log->next;
+        for (size_t k = 0; k < log->rec.n && !lost; k++)
+        {
+            if (append(rec, log->rec.addrs[k], log->rec.ops[k]) < 0)
+                lost = 1;
+        }
+        if (log->lost)
+            lost = 1;
+        free(log->rec.addrs);
+        free(log->rec.ops);
+        free(log);
+    }
+    logs = NULL;
+    logs_tail = &logs;
+    pthread_mutex_unlock(&logs_lock);
+    return lost ? -1 : 0;
+}
+
+void record_access(uint64_t addr, uint8_t op)
+{
+    struct thread_log *log;
+
+    // frames of the code being recorded lie below its caller's, see recorder.h
+    if (!recording || (addr < stack_top && addr >= stack_top - RECORD_STACK_SPAN))
+        return;
+
+    if (recording_here)
+    {
+        if (append(recording, addr, op) < 0)
+            lost = 1;
+    }
+    else if ((log = worker_log()) == NULL || append(&log->rec, addr, op) < 0)
+    {
+        if (log)
+            log->lost = 1;
+        else
+            __atomic_store_n(&lost, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* The hooks of one access size; unaligned accesses are recorded alike */
+#define ACCESS_HOOKS(size)                                                             \
+    void __tsan_read##size(void *addr) { record_access((uintptr_t)addr, 'L'); }           \
+    void __tsan_write##size(void *addr) { record_access((uintptr_t)addr, 'S'); }          \
+    void __tsan_unaligned_read##size(void *addr) { record_access((uintptr_t)addr, 'L'); } \
+    void __tsan_unaligned_write##size(void *addr) { record_access((uintptr_t)addr, 'S'); }
+
+ACCESS_HOOKS(1)
+ACCESS_HOOKS(2)
+ACCESS_HOOKS(4)
+ACCESS_HOOKS(8)
+ACCESS_HOOKS(16)
+
+/*
+ * A range is one instruction's operand wider than 16 bytes, such as an AVX2
+ * load or store, which valgrind traces as a single access of that size
+ */
+void __tsan_read_range(void *addr, unsigned long size)
+{
+    record_access((uintptr_t)addr, 'L');
+}
+
+void __tsan_write_range(void *addr, unsigned long size)
+{
+    record_access((uintptr_t)addr, 'S');
+}
+
+void __tsan_func_entry(void *call_pc)
+{
+}
+
+void __tsan_func_exit(void)
+{
+}
+
+void __tsan_init(void)
+{
+}
@@ -0,0 +1,53 @@
+/*
+ * recorder.h - Record the memory accesses of trans.c without valgrind
+ *
+ * tracegen-native links a copy of trans.c compiled with -fsanitize=thread.
+ * gcc then calls a __tsan_* hook before every load and store the transpose
+ * functions make to memory that outlives the call, which is the matrices
+ * and any other globals, but not locals kept in registers. recorder.c
+ * supplies those hooks in place of the ThreadSanitizer runtime and appends
+ * each access to a buffer of the thread that made it while recording is on.
+ *
+ * What is recorded is meant to match what test-trans keeps of a valgrind
+ * trace, which drops every address at or above 4GB, the main stack's
+ * among them. So an access, from any thread, to the 64MB (RECORD_STACK_SPAN)
+ * bytes below the frame passed to record_start is dropped: the frames of
+ * the transpose and the locals it hands to its worker threads. Accesses
+ * to a worker thread's own stack are recorded, as valgrind maps thread
+ * stacks below 4GB. Not recorded at all are accesses made by code built
+ * without the hooks, such as the loads of the function pointer, M and N
+ * that valgrind sees tracegen make between the markers.
+ */
+
+#ifndef CSIM_RECORDER_H
+#define CSIM_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Accesses recorded between record_start and record_stop */
+struct recording
+{
+    uint64_t *addrs;
+    uint8_t *ops; // 'L' or 'S', as in a trace
+    size_t n;
+    size_t cap;
+};
+
+/*
+ * Start appending accesses to rec, dropping its previous contents; frame is
+ * __builtin_frame_address(0) of the caller, which must also call the code
+ */
+void record_start(struct recording *rec, const void *frame);
+
+/*
+ * Stop recording, once any threads the recorded code started are joined,
+ * and append their accesses to the caller's; return -1 if a buffer
+ * couldn't grow and accesses were lost
+ */
+int record_stop(void);
+
+/* Append an access the instrumented code can't report itself */
+void record_access(uint64_t addr, uint8_t op);
+
+#endif /* CSIM_RECORDER_H */
@@ -3,6 +3,7 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _XOPEN_SOURCE 700 // for mkdtemp
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,10 +15,15 @@
 #include "cachelab.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
+#include <stdarg.h>
+#include <pthread.h>
 
 /* Maximum array dimension */
 #define MAXN 256
 
+/* Most functions evaluated at once with -j */
+#define MAX_JOBS 64
+
 /* The description string for the transpose_submit() function that the
    student submits for credit */
 #define SUBMIT_DESCRIPTION "Transpose submission"
@@ -32,6 +38,8 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static int native = 0; /* -n: run tracegen-native instead of valgrind */
+static int jobs = 1;   /* -j: functions evaluated at once */
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,132 +49,271 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
-/* 
- * eval_perf - Evaluate the performance of the registered transpose functions
+/* Evaluation of one transpose function, done in its own directory */
+struct func_eval {
+    int fn;
+    char dir[64];          /* private directory of the tracegen run */
+    char log[1024];        /* progress messages, printed in function order */
+    size_t log_len;
+    int correct;
+    unsigned int hits, misses, evictions;
+    int done;              /* set under eval_lock once the log is complete */
+};
+
+/* The functions to evaluate and the cache to evaluate them on */
+struct eval_job {
+    struct func_eval *evals;
+    unsigned int s, E, b;
+};
+
+/* Directory test-trans was started in, holding the tools it runs */
+static char tools_dir[PATH_MAX];
+
+/* Functions handed out to the -j workers so far */
+static int next_func = 0;
+static pthread_mutex_t eval_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eval_done = PTHREAD_COND_INITIALIZER;
+
+/*
+ * log_eval - Append a progress message to the log of an evaluation
  */
-void eval_perf(unsigned int s, unsigned int E, unsigned int b)
+void log_eval(struct func_eval *ev, const char *fmt, ...)
 {
-    int i,flag;
-    unsigned int len, hits, misses, evictions;
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(ev->log + ev->log_len, sizeof(ev->log) - ev->log_len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        ev->log_len += n;
+    if (ev->log_len >= sizeof(ev->log))
+        ev->log_len = sizeof(ev->log) - 1;
+}
+
+/*
+ * simulate_trace - Cut function fn's accesses out of the valgrind trace
+ *     in trace.tmp and run the reference simulator on them, which leaves
+ *     its results in .csim_results of the evaluation's directory
+ */
+void simulate_trace(struct func_eval *ev, unsigned int s, unsigned int E, unsigned int b)
+{
+    int flag;
+    unsigned int len;
     unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
+    char buf[1000], cmd[2 * PATH_MAX + 256];
     char filename[128];
+    FILE* full_trace_fp;
+    FILE* part_trace_fp;
+
+    /* Get the start and end marker addresses */
+    sprintf(filename, "%s/.marker", ev->dir);
+    FILE* marker_fp = fopen(filename, "r");
+    assert(marker_fp);
+    fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
+    fclose(marker_fp);
+
+    sprintf(filename, "%s/trace.tmp", ev->dir);
+    full_trace_fp = fopen(filename, "r");
+    assert(full_trace_fp);
+
+
+    /* Filtered trace for each transpose function goes in a separate file */
+    sprintf(filename, "trace.f%d", ev->fn);
+    part_trace_fp = fopen(filename, "w");
+    assert(part_trace_fp);
+
+    /* Locate trace corresponding to the trans function */
+    flag = 0;
+    while (fgets(buf, 1000, full_trace_fp) != NULL) {
+
+        /* We are only interested in memory access instructions */
+        if (buf[0]==' ' && buf[2]==' ' &&
+            (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
+            sscanf(buf+3, "%llx,%u", &addr, &len);
+    
+            /* If start marker found, set flag */
+            if (addr == marker_start)
+                flag = 1;
+
+            /* Valgrind creates many spurious accesses to the
+               stack that have nothing to do with the students
+               code. At the moment, we are ignoring all stack
+               accesses by using the simple filter of recording
+               accesses to only the low 32-bit portion of the
+               address space. At some point it would be nice to
+               try to do more informed filtering so that would
+               eliminate the valgrind stack references while
+               include the student stack references. */
+            if (flag && addr < 0xffffffff) {
+                fputs(buf, part_trace_fp);
+            }
 
-    registerFunctions(); 
-
-    /* Open the complete trace file */
-    FILE* full_trace_fp;  
-    FILE* part_trace_fp; 
+            /* if end marker found, close trace file */
+            if (addr == marker_end) {
+                flag = 0;
+                fclose(part_trace_fp);
+                break;
+            }
+        }
+    }
+    fclose(full_trace_fp);
 
-    /* Evaluate the performance of each registered transpose function */
+    /* Run the reference simulator */
+    log_eval(ev, "Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
+    snprintf(cmd, sizeof(cmd), "cd %s && %s/csim-ref -s %u -E %u -b %u -t %s/trace.f%d > /dev/null", 
+            ev->dir, tools_dir, s, E, b, tools_dir, ev->fn);
+    system(cmd);
+}
 
-    for (i=0; i<func_counter; i++) {
-        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
-            results.funcid = i; /* remember which function is the submission */
+/*
+ * eval_func - Validate function ev->fn and count its hits, misses and
+ *     evictions, running the tools in a private directory so that any
+ *     number of functions can be evaluated at once
+ */
+void eval_func(struct func_eval *ev, unsigned int s, unsigned int E, unsigned int b)
+{
+    int flag;
+    unsigned int hits, misses, evictions;
+    char cmd[2 * PATH_MAX + 256];
+    char filename[128];
+    const char *tmp_files[] = {"trace.tmp", ".marker", ".regions", ".csim_results"};
 
+    strcpy(ev->dir, "/tmp/test-trans.XXXXXX");
+    if (!mkdtemp(ev->dir)) {
+        log_eval(ev, "Error: cannot create a directory for function %d\n", ev->fn);
+        return;
+    }
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
+    log_eval(ev, "\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",ev->fn,func_counter);
+    if (native) {
+        /* tracegen-native records the trace and simulates it itself */
+        snprintf(cmd, sizeof(cmd), "cd %s && %s/tracegen-native -M %d -N %d -F %d -s %u -E %u -b %u > /dev/null",
+                ev->dir, tools_dir, M, N, ev->fn, s, E, b);
+    } else {
         /* Use valgrind to generate the trace */
+        snprintf(cmd, sizeof(cmd), "cd %s && valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v %s/tracegen -M %d -N %d -F %d  > trace.tmp",
+                ev->dir, tools_dir, M, N, ev->fn);
+    }
+    flag=WEXITSTATUS(system(cmd));
+    if (0!=flag) {
+        log_eval(ev, "Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,ev->fn);
+    } else {
+        ev->correct = 1;
+        if (native)
+            log_eval(ev, "Step 2: Evaluating performance natively (s=%d, E=%d, b=%d)\n", s, E, b);
+        else
+            simulate_trace(ev, s, E, b);
+
+        /* Collect results from the simulator */
+        sprintf(filename, "%s/.csim_results", ev->dir);
+        FILE* in_fp = fopen(filename,"r");
+        assert(in_fp);
+        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
+        fclose(in_fp);
+        ev->hits = hits;
+        ev->misses = misses;
+        ev->evictions = evictions;
+        log_eval(ev, "func %u (%s): hits:%u, misses:%u, evictions:%u\n",
+                 ev->fn, func_list[ev->fn].description, hits, misses, evictions);
+    }
 
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
-        if (0!=flag) {
-            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
-            continue;
-        }
+    for (int k = 0; k < sizeof(tmp_files) / sizeof(tmp_files[0]); k++) {
+        sprintf(filename, "%s/%s", ev->dir, tmp_files[k]);
+        unlink(filename);
+    }
+    rmdir(ev->dir);
+}
 
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
+/*
+ * eval_worker - Evaluate functions until none are left
+ */
+void *eval_worker(void *arg)
+{
+    struct eval_job *job = arg;
 
+    while (1) {
+        pthread_mutex_lock(&eval_lock);
+        int i = next_func++;
+        pthread_mutex_unlock(&eval_lock);
+        if (i >= func_counter)
+            return NULL;
 
-        func_list[i].correct=1;
+        eval_func(&job->evals[i], job->s, job->E, job->b);
 
-        /* Save the correctness of the transpose submission */
-        if (results.funcid == i ) {
-            results.correct = 1;
-        }
+        pthread_mutex_lock(&eval_lock);
+        job->evals[i].done = 1;
+        pthread_cond_broadcast(&eval_done);
+        pthread_mutex_unlock(&eval_lock);
+    }
+}
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
+/* 
+ * eval_perf - Evaluate the performance of the registered transpose
+ *     functions, jobs of them at a time, and print the results in the
+ *     order the functions were registered
+ */
+void eval_perf(unsigned int s, unsigned int E, unsigned int b, int jobs)
+{
+    int i;
+    pthread_t workers[MAX_JOBS];
 
+    registerFunctions(); 
+    if (!getcwd(tools_dir, sizeof(tools_dir))) {
+        printf("Error: cannot get the current directory\n");
+        exit(1);
+    }
 
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
-    
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
-        
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
-                }
-
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
-            }
-        }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
-        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
-               i, func_list[i].description, hits, misses, evictions);
-    
-        /* If it is transpose_submit(), record number of misses */
-        if (results.funcid == i) {
-            results.misses = misses;
+    struct func_eval *evals = calloc(func_counter, sizeof(struct func_eval));
+    struct eval_job job = {evals, s, E, b};
+    assert(evals);
+
+    for (i=0; i<func_counter; i++) {
+        evals[i].fn = i;
+        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
+            results.funcid = i; /* remember which function is the submission */
+    }
+
+    /* Evaluate the performance of each registered transpose function */
+    if (jobs > func_counter)
+        jobs = func_counter;
+    for (i=0; i<jobs; i++)
+        pthread_create(&workers[i], NULL, eval_worker, &job);
+
+    /* Print each function as soon as all the ones before it are done */
+    for (i=0; i<func_counter; i++) {
+        pthread_mutex_lock(&eval_lock);
+        while (!evals[i].done)
+            pthread_cond_wait(&eval_done, &eval_lock);
+        pthread_mutex_unlock(&eval_lock);
+
+        fputs(evals[i].log, stdout);
+        fflush(stdout);
+        func_list[i].correct = evals[i].correct;
+        func_list[i].num_hits = evals[i].hits;
+        func_list[i].num_misses = evals[i].misses;
+        func_list[i].num_evictions = evals[i].evictions;
+
+        /* If it is transpose_submit(), record its correctness and misses */
+        if (results.funcid == i && evals[i].correct) {
+            results.correct = 1;
+            results.misses = evals[i].misses;
         }
     }
-  
+    for (i=0; i<jobs; i++)
+        pthread_join(workers[i], NULL);
+    free(evals);
 }
 
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hn] [-j <jobs>] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
+    printf("  -n          Trace natively with tracegen-native, without valgrind.\n");
+    printf("  -j <jobs>   Evaluate up to %d functions at once (default 1)\n", MAX_JOBS);
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -199,7 +346,7 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:nj:h")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +354,12 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'n':
+            native = 1;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -222,6 +375,12 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (jobs < 1 || jobs > MAX_JOBS) {
+        printf("Error: -j must be between 1 and %d\n", MAX_JOBS);
+        usage(argv);
+        exit(1);
+    }
+
     if (M > MAXN || N > MAXN) {
         printf("Error: M or N exceeds %d\n", MAXN);
         usage(argv);
@@ -243,7 +402,7 @@ int main(int argc, char* argv[])
     alarm(120);
 
     /* Check the performance of the student's transpose function */
-    eval_perf(5, 1, 5);
+    eval_perf(5, 1, 5, jobs);
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
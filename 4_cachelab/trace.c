@@ -0,0 +1,488 @@
+/*
+ * trace.c - Readers for the memory traces replayed by csim
+ *
+ * Text traces are mapped and decoded in place with no per-line libc
+ * calls; packed traces written by csim-pack are detected by their magic
+ * and streamed straight out of the same mapping. Pipes are read ahead by
+ * a helper thread into double buffers that are decoded the same way.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for posix_madvise and pthreads
+
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define STREAM_BUF_SIZE (1 << 20) // bytes of each buffer of a streamed trace
+
+/*
+ * Read-ahead state of a trace that can't be mapped. The helper thread
+ * fills buf[i] while the decoder works on the other one; a buffer always
+ * ends on a line boundary, the partial last line is carried into the next
+ * buffer, so no record straddles two of them.
+ */
+struct trace_stream
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int fd;
+
+    char *buf[2];
+    size_t len[2];
+    int ready[2]; // filled and not yet given back by the decoder
+    int last[2];  // no buffer follows this one
+    int cur;      // buffer the decoder works on
+    int stop;     // decoder closed early, drain the rest of the input
+};
+
+static int read_record(struct trace_reader *r, struct access *rec);
+static int next_text_record(struct trace_reader *r, struct access *rec);
+static int next_packed_record(struct trace_reader *r, struct access *rec);
+static int read_varint(const char **p, const char *end, __uint64_t *val);
+static int read_header(struct trace_reader *r);
+static int load_markers(struct trace_reader *r);
+static int open_stream(struct trace_reader *r, int fd);
+static int next_stream_buffer(struct trace_reader *r);
+static void close_stream(struct trace_reader *r);
+static void *stream_reader(void *arg);
+
+/*
+ * value of each hex digit plus one, 0 for any other byte
+ */
+static const unsigned char hex_digit[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/*
+ * open a trace for next_record, mapping it when it is a regular file
+ * return -1 if the trace can't be opened
+ */
+int open_trace(struct trace_reader *r, char *trace_file)
+{
+    struct stat st;
+    int fd = strcmp(trace_file, "-") ? open(trace_file, O_RDONLY) : STDIN_FILENO;
+
+    memset(r, 0, sizeof(*r));
+    if (fd < 0)
+    {
+        printf("Cannot open trace file %s\n", trace_file);
+        return -1;
+    }
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        r->map_len = st.st_size;
+        r->map = mmap(NULL, r->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (r->map && r->map != MAP_FAILED)
+    {
+        posix_madvise(r->map, r->map_len, POSIX_MADV_SEQUENTIAL);
+        r->p = r->map;
+        r->end = r->p + r->map_len;
+        r->bytes = r->map_len;
+        close(fd);
+
+        if (r->map_len >= PACK_MAGIC_LEN && !memcmp(r->p, PACK_MAGIC, PACK_MAGIC_LEN))
+        {
+            if (read_header(r) < 0)
+            {
+                printf("Truncated packed trace %s\n", trace_file);
+                close_trace(r);
+                return -1;
+            }
+        }
+    }
+    else
+    {
+        // stream anything that can't be mapped through the reader thread
+        r->map = NULL;
+        if (open_stream(r, fd) < 0)
+        {
+            printf("Cannot stream trace file %s\n", trace_file);
+            close_trace(r);
+            return -1;
+        }
+        if (r->end - r->p >= PACK_MAGIC_LEN && !memcmp(r->p, PACK_MAGIC, PACK_MAGIC_LEN))
+        {
+            printf("Packed trace %s must be read from a regular file\n", trace_file);
+            close_trace(r);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void set_marker_window(struct trace_reader *r, const char *marker_file)
+{
+    r->marker_file = marker_file;
+    r->window = WINDOW_UNLOADED;
+}
+
+int next_record(struct trace_reader *r, struct access *rec)
+{
+    if (r->window == WINDOW_OFF)
+        return read_record(r, rec);
+
+    if (r->window == WINDOW_UNLOADED && load_markers(r) < 0)
+        return 0;
+    while (r->window != WINDOW_DONE && read_record(r, rec))
+    {
+        // tracegen's markers and the transpose itself are all data accesses
+        if (rec->type == 'I')
+            continue;
+        if (rec->addr == r->marker_start)
+            r->window = WINDOW_IN;
+        if (r->window == WINDOW_IN && rec->addr == r->marker_end)
+            r->window = WINDOW_DONE;
+        else if (r->window != WINDOW_IN)
+            continue;
+        if (rec->addr < WINDOW_ADDR_LIMIT)
+            return 1;
+    }
+    return 0;
+}
+
+void close_trace(struct trace_reader *r)
+{
+    if (r->map)
+        munmap(r->map, r->map_len);
+    if (r->stream)
+        close_stream(r);
+}
+
+/*
+ * decode the next record of whichever encoding, moving on to the next
+ * buffer of a streamed trace when this one runs out
+ */
+static int read_record(struct trace_reader *r, struct access *rec)
+{
+    if (r->packed)
+        return next_packed_record(r, rec);
+    while (!next_text_record(r, rec))
+    {
+        if (!r->stream || !next_stream_buffer(r))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * read the start and end marker addresses for the window
+ */
+static int load_markers(struct trace_reader *r)
+{
+    FILE *f = fopen(r->marker_file, "r");
+    unsigned long start, end;
+    int n;
+
+    if (!f)
+    {
+        printf("Cannot open marker file %s\n", r->marker_file);
+        return -1;
+    }
+    n = fscanf(f, "%lx %lx", &start, &end);
+    fclose(f);
+    if (n != 2)
+    {
+        printf("Bad marker file %s\n", r->marker_file);
+        return -1;
+    }
+
+    r->marker_start = start;
+    r->marker_end = end;
+    r->window = WINDOW_BEFORE;
+    return 0;
+}
+
+/*
+ * decode the next " op addr,size" record into rec
+ * return 0 at the end of the trace, lines that don't parse are skipped
+ */
+static int next_text_record(struct trace_reader *r, struct access *rec)
+{
+    const char *p = r->p;
+    const char *end = r->end;
+
+    while (1)
+    {
+        __uint64_t addr = 0;
+        int size = 0;
+        int digits = 0;
+        int d;
+
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+        if (p == end)
+        {
+            r->p = p;
+            return 0;
+        }
+
+        rec->type = *p++;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        while (p < end && (d = hex_digit[(unsigned char)*p]))
+        {
+            addr = addr << 4 | (d - 1);
+            digits++;
+            p++;
+        }
+
+        if (digits && p < end && *p == ',')
+        {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+                size = size * 10 + (*p - '0');
+            while (p < end && *p != '\n')
+                p++;
+
+            rec->addr = addr;
+            rec->size = size;
+            r->p = p;
+            return 1;
+        }
+
+        // not a record, drop the rest of the line
+        while (p < end && *p != '\n')
+            p++;
+    }
+}
+
+/*
+ * decode the next packed record into rec
+ * return 0 at the end of the trace or on a truncated record
+ */
+static int next_packed_record(struct trace_reader *r, struct access *rec)
+{
+    const char *p = r->p;
+    __uint64_t size, delta;
+    unsigned char op;
+
+    if (p == r->end)
+        return 0;
+
+    op = *p++;
+    size = op >> 2;
+    if (size == PACK_SIZE_ESC && read_varint(&p, r->end, &size) < 0)
+        return 0;
+    if (read_varint(&p, r->end, &delta) < 0)
+        return 0;
+
+    // undo the zigzag mapping, small deltas of either sign are small varints
+    r->prev_addr += (delta >> 1) ^ -(delta & 1);
+    rec->type = PACK_OPS[op & 3];
+    rec->addr = r->prev_addr;
+    rec->size = (int)size;
+    r->p = p;
+    return 1;
+}
+
+/*
+ * read a LEB128 varint at *p, return -1 if it runs past end
+ */
+static int read_varint(const char **p, const char *end, __uint64_t *val)
+{
+    const unsigned char *q = (const unsigned char *)*p;
+    __uint64_t v = 0;
+    int shift = 0;
+
+    while ((const char *)q < end && shift < 64)
+    {
+        v |= (__uint64_t)(*q & 0x7f) << shift;
+        if (!(*q++ & 0x80))
+        {
+            *val = v;
+            *p = (const char *)q;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/*
+ * skip the packed header, keeping the record count
+ */
+static int read_header(struct trace_reader *r)
+{
+    unsigned int name_len;
+    const char *p = r->p + PACK_MAGIC_LEN;
+
+    if (r->end - p < sizeof(r->count) + sizeof(name_len))
+        return -1;
+    memcpy(&r->count, p, sizeof(r->count));
+    p += sizeof(r->count);
+    memcpy(&name_len, p, sizeof(name_len));
+    p += sizeof(name_len);
+    if (r->end - p < name_len)
+        return -1;
+
+    r->p = p + name_len;
+    r->packed = 1;
+    r->prev_addr = 0;
+    return 0;
+}
+
+/*
+ * start the reader thread on fd and wait for the first buffer
+ */
+static int open_stream(struct trace_reader *r, int fd)
+{
+    struct trace_stream *st = calloc(1, sizeof(struct trace_stream));
+
+    st->fd = fd;
+    st->buf[0] = malloc(STREAM_BUF_SIZE);
+    st->buf[1] = malloc(STREAM_BUF_SIZE);
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->cond, NULL);
+    r->stream = st;
+    if (pthread_create(&st->thread, NULL, stream_reader, st))
+    {
+        free(st->buf[0]);
+        free(st->buf[1]);
+        free(st);
+        r->stream = NULL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&st->lock);
+    while (!st->ready[0])
+        pthread_cond_wait(&st->cond, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+
+    r->p = st->buf[0];
+    r->end = r->p + st->len[0];
+    r->bytes = st->len[0];
+    return 0;
+}
+
+/*
+ * give the decoded buffer back to the reader thread and wait for the other
+ * return 0 once the input is exhausted
+ */
+static int next_stream_buffer(struct trace_reader *r)
+{
+    struct trace_stream *st = r->stream;
+    int cur = st->cur;
+
+    if (st->last[cur])
+        return 0;
+
+    pthread_mutex_lock(&st->lock);
+    st->ready[cur] = 0;
+    pthread_cond_broadcast(&st->cond);
+    cur ^= 1;
+    while (!st->ready[cur])
+        pthread_cond_wait(&st->cond, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+
+    st->cur = cur;
+    r->p = st->buf[cur];
+    r->end = r->p + st->len[cur];
+    r->bytes += st->len[cur];
+    return 1;
+}
+
+/*
+ * stop decoding: the reader thread drains the rest of the input, so a
+ * writer at the other end of the pipe isn't killed by SIGPIPE
+ */
+static void close_stream(struct trace_reader *r)
+{
+    struct trace_stream *st = r->stream;
+
+    pthread_mutex_lock(&st->lock);
+    st->stop = 1;
+    st->ready[0] = st->ready[1] = 0;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+    pthread_join(st->thread, NULL);
+
+    if (st->fd != STDIN_FILENO)
+        close(st->fd);
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->cond);
+    free(st->buf[0]);
+    free(st->buf[1]);
+    free(st);
+    r->stream = NULL;
+}
+
+/*
+ * fill the two buffers in turn until the input ends, cutting each after its
+ * last complete line
+ */
+static void *stream_reader(void *arg)
+{
+    struct trace_stream *st = arg;
+    char *carry = malloc(STREAM_BUF_SIZE);
+    size_t carry_len = 0;
+    int eof = 0;
+
+    for (int i = 0; !eof; i ^= 1)
+    {
+        char *buf = st->buf[i];
+        size_t len = carry_len;
+        ssize_t n;
+        int stop;
+
+        pthread_mutex_lock(&st->lock);
+        while (st->ready[i] && !st->stop)
+            pthread_cond_wait(&st->cond, &st->lock);
+        stop = st->stop;
+        pthread_mutex_unlock(&st->lock);
+        if (stop)
+            break;
+
+        memcpy(buf, carry, carry_len);
+        while (len < STREAM_BUF_SIZE)
+        {
+            n = read(st->fd, buf + len, STREAM_BUF_SIZE - len);
+            if (n <= 0)
+            {
+                eof = 1;
+                break;
+            }
+            len += n;
+        }
+
+        // keep the partial last line for the next buffer, unless it fills this one
+        carry_len = 0;
+        if (!eof)
+        {
+            size_t cut = len;
+
+            while (cut > 0 && buf[cut - 1] != '\n')
+                cut--;
+            if (cut > 0)
+            {
+                carry_len = len - cut;
+                memcpy(carry, buf + cut, carry_len);
+                len = cut;
+            }
+        }
+
+        pthread_mutex_lock(&st->lock);
+        st->len[i] = len;
+        st->last[i] = eof;
+        st->ready[i] = 1;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+    }
+
+    // the decoder is gone, swallow whatever the writer still sends
+    while (!eof && read(st->fd, carry, STREAM_BUF_SIZE) > 0)
+        ;
+    free(carry);
+    return NULL;
+}
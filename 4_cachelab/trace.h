@@ -0,0 +1,100 @@
+/*
+ * trace.h - Readers for the memory traces replayed by csim
+ *
+ * Two encodings are understood:
+ *
+ * text    valgrind lackey output, one " op addr,size" record per line
+ *
+ * packed  the compact format written by csim-pack, all integers little-endian:
+ *           header: PACK_MAGIC (8 bytes)
+ *                   record count (8 bytes)
+ *                   length of the source name (4 bytes), then the name
+ *           record: one byte with the op in bits 0-1 (see PACK_OPS) and the
+ *                   size in bits 2-7; a size of PACK_SIZE_ESC or more is
+ *                   stored as PACK_SIZE_ESC followed by a varint of the size
+ *                   then a zigzag varint of the address delta from the
+ *                   previous record
+ *
+ * A trace named "-" is read from stdin. Input that can't be mapped, such as
+ * a pipe from valgrind, is read by a helper thread into two buffers that are
+ * filled and decoded in turn; only text traces can be streamed this way.
+ */
+
+#ifndef CSIM_TRACE_H
+#define CSIM_TRACE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define PACK_MAGIC "CSIMPAK1"
+#define PACK_MAGIC_LEN 8
+#define PACK_OPS "ILSM"    /* op of each 2-bit code */
+#define PACK_SIZE_ESC 63   /* largest size that fits in the op byte */
+
+/* Records at or above this address are valgrind's own stack, not the program's */
+#define WINDOW_ADDR_LIMIT 0xffffffff
+
+/* Progress of a trace_reader through a marker window */
+enum trace_window
+{
+    WINDOW_OFF,      // every record is returned
+    WINDOW_UNLOADED, // marker file not read yet
+    WINDOW_BEFORE,   // waiting for the start marker
+    WINDOW_IN,       // between the start and end markers
+    WINDOW_DONE,     // end marker seen, the trace is over
+};
+
+struct trace_stream; /* helper thread of a streamed trace, see trace.c */
+
+/* One decoded trace record */
+struct access
+{
+    __uint64_t addr;
+    int size;
+    char type;
+};
+
+/*
+ * Sequential reader over a trace. The file is mapped and decoded in place
+ * when possible; stream is only used for inputs that cannot be mapped.
+ */
+struct trace_reader
+{
+    const char *p;   // next byte to decode
+    const char *end; // one past the last byte of the mapping or buffer
+    void *map;
+    size_t map_len;
+    struct trace_stream *stream;
+    size_t bytes; // input bytes handed to the decoder so far
+
+    int packed;           // the mapping holds a csim-pack trace
+    __uint64_t prev_addr; // address of the last packed record
+    __uint64_t count;     // records announced by a packed header
+
+    /*
+     * Marker window: only the data accesses from the start marker through
+     * the end marker, below WINDOW_ADDR_LIMIT, are returned, the way
+     * test-trans cuts one transpose function out of a tracegen trace.
+     */
+    enum trace_window window;
+    const char *marker_file; // written by tracegen: "<start> <end>" in hex
+    __uint64_t marker_start;
+    __uint64_t marker_end;
+};
+
+/* Open a trace of either encoding, "-" is stdin; return -1 if it can't be opened */
+int open_trace(struct trace_reader *r, char *trace_file);
+
+/*
+ * Only return the records inside the marker window of marker_file, which
+ * is read when the first record is decoded so that a tracegen writing it
+ * at the head of a pipe has had the chance to
+ */
+void set_marker_window(struct trace_reader *r, const char *marker_file);
+
+/* Decode the next record into rec, return 0 at the end of the trace */
+int next_record(struct trace_reader *r, struct access *rec);
+
+void close_trace(struct trace_reader *r);
+
+#endif /* CSIM_TRACE_H */
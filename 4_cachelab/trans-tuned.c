@@ -0,0 +1,25 @@
+/*
+ * trans-tuned.c - Transpose kernels picked by tune-trans, do not edit
+ */
+
+#include <stddef.h>
+#include "trans-variant.h"
+
+DEFINE_VARIANT(tuned_32x32_s5_E1_b5, 8, 8, 1, STAGE_NONE)
+
+const struct tuned_kernel tuned_kernels[] = {
+    {32, 32, 5, 1, 5, tuned_32x32_s5_E1_b5, "Tuned: 8x8 blocks, diagonal last"},
+};
+const int num_tuned_kernels = sizeof(tuned_kernels) / sizeof(tuned_kernels[0]);
+
+const struct tuned_kernel *find_tuned_kernel(int M, int N, int s, int E, int b)
+{
+    for (int i = 0; i < num_tuned_kernels; i++)
+    {
+        const struct tuned_kernel *k = &tuned_kernels[i];
+
+        if (k->M == M && k->N == N && k->s == s && k->E == E && k->b == b)
+            return k;
+    }
+    return NULL;
+}
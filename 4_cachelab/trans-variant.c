@@ -0,0 +1,14 @@
+/*
+ * trans-variant.c - A runtime-parameterized transpose_variant for tune-trans
+ *
+ * Compiled with -fsanitize=thread like trans-native.o, so the recorder sees
+ * the same loads and stores of A and B that a DEFINE_VARIANT instance of
+ * the same parameters makes.
+ */
+
+#include "trans-variant.h"
+
+void run_variant(const struct trans_variant *v, int M, int N, int A[N][M], int B[M][N])
+{
+    transpose_variant(M, N, A, B, v->rows, v->cols, v->defer_diag, v->stage);
+}
@@ -0,0 +1,210 @@
+/*
+ * trans-variant.h - The parameterized blocked transpose searched by tune-trans
+ *
+ * A variant walks A in blocks of rows x cols and writes each block to B
+ * with one of three inner loops:
+ *
+ * STAGE_NONE   element by element, optionally writing the diagonal element
+ *              of each row last so that A[i][i] and B[i][i], which share a
+ *              set when A and B are aligned alike, don't evict each other
+ *              mid-row
+ * STAGE_ROW    a row of the block is read into the scalar locals t0..t7
+ *              before any of it is written, as transpose_64 does with
+ *              x1..x8
+ * STAGE_SPLIT  full 8x8 blocks are moved as four 4x4 quadrants, parking the
+ *              top right one in B's spare half row, as transpose_64 does;
+ *              other blocks fall back to STAGE_NONE
+ *
+ * DEFINE_VARIANT instantiates transpose_variant with constant parameters,
+ * which is how tune-trans writes its winners into trans-tuned.c.
+ */
+
+#ifndef TRANS_VARIANT_H
+#define TRANS_VARIANT_H
+
+#define STAGE_NONE 0
+#define STAGE_ROW 1
+#define STAGE_SPLIT 2
+
+#define MAX_STAGE_COLS 8 // widest block row STAGE_ROW keeps in t0..t7
+
+/* One point of the search space */
+struct trans_variant
+{
+    int rows;       // block height, in rows of A
+    int cols;       // block width, in columns of A
+    int defer_diag; // STAGE_NONE: write the diagonal element of a row last
+    int stage;      // STAGE_*
+};
+
+/* A tuned kernel and the matrix and cache it won on */
+struct tuned_kernel
+{
+    int M, N;
+    int s, E, b;
+    void (*func)(int M, int N, int A[N][M], int B[M][N]);
+    const char *desc;
+};
+
+/* Defined by tune-trans in trans-tuned.c */
+extern const struct tuned_kernel tuned_kernels[];
+extern const int num_tuned_kernels;
+
+/* Return the kernel tuned for an M x N matrix on cache (s, E, b), NULL if none was */
+const struct tuned_kernel *find_tuned_kernel(int M, int N, int s, int E, int b);
+
+/* Run variant v, defined in trans-variant.c for tune-trans */
+void run_variant(const struct trans_variant *v, int M, int N, int A[N][M], int B[M][N]);
+
+/*
+ * move the 8x8 block at row i, column j of A through four 4x4 quadrants
+ */
+static inline void transpose_split8(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+    int x, y, t0, t1, t2, t3, t4, t5, t6, t7;
+
+    // top half of A: left quadrant to its place, right one parked in B
+    for (x = i; x < i + 4; x++)
+    {
+        t0 = A[x][j + 0];
+        t1 = A[x][j + 1];
+        t2 = A[x][j + 2];
+        t3 = A[x][j + 3];
+        t4 = A[x][j + 4];
+        t5 = A[x][j + 5];
+        t6 = A[x][j + 6];
+        t7 = A[x][j + 7];
+        B[j + 0][x] = t0;
+        B[j + 1][x] = t1;
+        B[j + 2][x] = t2;
+        B[j + 3][x] = t3;
+        B[j + 0][x + 4] = t4;
+        B[j + 1][x + 4] = t5;
+        B[j + 2][x + 4] = t6;
+        B[j + 3][x + 4] = t7;
+    }
+
+    // bottom left quadrant of A replaces the parked one, which moves down
+    for (y = j; y < j + 4; y++)
+    {
+        t0 = A[i + 4][y];
+        t1 = A[i + 5][y];
+        t2 = A[i + 6][y];
+        t3 = A[i + 7][y];
+        t4 = B[y][i + 4];
+        t5 = B[y][i + 5];
+        t6 = B[y][i + 6];
+        t7 = B[y][i + 7];
+        B[y][i + 4] = t0;
+        B[y][i + 5] = t1;
+        B[y][i + 6] = t2;
+        B[y][i + 7] = t3;
+        B[y + 4][i + 0] = t4;
+        B[y + 4][i + 1] = t5;
+        B[y + 4][i + 2] = t6;
+        B[y + 4][i + 3] = t7;
+    }
+
+    // bottom right quadrant
+    for (x = i + 4; x < i + 8; x++)
+    {
+        t0 = A[x][j + 4];
+        t1 = A[x][j + 5];
+        t2 = A[x][j + 6];
+        t3 = A[x][j + 7];
+        B[j + 4][x] = t0;
+        B[j + 5][x] = t1;
+        B[j + 6][x] = t2;
+        B[j + 7][x] = t3;
+    }
+}
+
+/*
+ * move the w <= MAX_STAGE_COLS elements of row i of A from column j on,
+ * all loads before any store
+ */
+static inline void transpose_row_staged(int M, int N, int A[N][M], int B[M][N], int i, int j, int w)
+{
+    int t0, t1 = 0, t2 = 0, t3 = 0, t4 = 0, t5 = 0, t6 = 0, t7 = 0;
+
+    t0 = A[i][j];
+    if (w > 1)
+        t1 = A[i][j + 1];
+    if (w > 2)
+        t2 = A[i][j + 2];
+    if (w > 3)
+        t3 = A[i][j + 3];
+    if (w > 4)
+        t4 = A[i][j + 4];
+    if (w > 5)
+        t5 = A[i][j + 5];
+    if (w > 6)
+        t6 = A[i][j + 6];
+    if (w > 7)
+        t7 = A[i][j + 7];
+
+    B[j][i] = t0;
+    if (w > 1)
+        B[j + 1][i] = t1;
+    if (w > 2)
+        B[j + 2][i] = t2;
+    if (w > 3)
+        B[j + 3][i] = t3;
+    if (w > 4)
+        B[j + 4][i] = t4;
+    if (w > 5)
+        B[j + 5][i] = t5;
+    if (w > 6)
+        B[j + 6][i] = t6;
+    if (w > 7)
+        B[j + 7][i] = t7;
+}
+
+/*
+ * B = A^T in blocks of rows x cols, see the top of this file for stage
+ */
+static inline void transpose_variant(int M, int N, int A[N][M], int B[M][N],
+                                     int rows, int cols, int defer_diag, int stage)
+{
+    int ii, jj, i, j;
+
+    for (ii = 0; ii < N; ii += rows)
+    {
+        int iend = ii + rows < N ? ii + rows : N;
+
+        for (jj = 0; jj < M; jj += cols)
+        {
+            int jend = jj + cols < M ? jj + cols : M;
+
+            if (stage == STAGE_SPLIT && iend - ii == 8 && jend - jj == 8)
+            {
+                transpose_split8(M, N, A, B, ii, jj);
+                continue;
+            }
+            for (i = ii; i < iend; i++)
+            {
+                if (stage == STAGE_ROW && jend - jj <= MAX_STAGE_COLS)
+                {
+                    transpose_row_staged(M, N, A, B, i, jj, jend - jj);
+                    continue;
+                }
+                for (j = jj; j < jend; j++)
+                {
+                    if (!defer_diag || i != j)
+                        B[j][i] = A[i][j];
+                }
+                if (defer_diag && i >= jj && i < jend)
+                    B[i][i] = A[i][i];
+            }
+        }
+    }
+}
+
+/* Define function name as variant (rows, cols, defer_diag, stage) */
+#define DEFINE_VARIANT(name, rows, cols, defer_diag, stage)             \
+    void name(int M, int N, int A[N][M], int B[M][N])                   \
+    {                                                                   \
+        transpose_variant(M, N, A, B, rows, cols, defer_diag, stage); \
+    }
+
+#endif /* TRANS_VARIANT_H */
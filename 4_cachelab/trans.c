@@ -6,17 +6,35 @@
  *
  * A transpose function is evaluated by counting the number of misses
  * on a 1KB direct mapped cache with a block size of 32 bytes.
+ *
+ * The production kernels at the end are meant for large matrices on real
+ * hardware instead, where bench-trans times them.
  * 
  * @author Li Li
  * @e-mail Lil147@pitt.edu
  */
+#define _POSIX_C_SOURCE 200809L // for sysconf
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
 #include "cachelab.h"
 
+#define TILE 32                        // production kernels: tile edge, in ints
+#define LEAF 16                        // largest piece transpose_recursive doesn't split
+#define MAX_TRANS_THREADS 64
+#define MIN_THREADED_ELEMS (512 * 512) // smaller matrices aren't worth starting threads
+
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 void transpose_32(int M, int N, int A[N][M], int B[M][N]);
 void transpose_64(int M, int N, int A[N][M], int B[M][N]);
 void transpose_others(int M, int N, int A[N][M], int B[M][N]);
+void transpose_tiled_avx2(int M, int N, int A[N][M], int B[M][N]);
+void transpose_recursive(int M, int N, int A[N][M], int B[M][N]);
+void transpose_threads(int M, int N, int A[N][M], int B[M][N]);
+static void transpose_8x8_avx2(int M, int N, int A[N][M], int B[M][N], int i, int j);
+
+static int use_avx2; // the cpu has AVX2, checked once by registerFunctions
 
 /* 
  * transpose_submit - This is the solution transpose function that you
@@ -238,6 +256,224 @@ void transpose_others(int M, int N, int A[N][M], int B[M][N])
     }
 }
 
+/*
+ * Production kernels. The ones above are tuned for the simulated 1KB
+ * cache; these are for transposing large matrices on a real cpu, where
+ * what matters is moving whole cache lines and using every core.
+ */
+
+/*
+ * transpose_block - B = A^T for rows [i0, i1) and columns [j0, j1) of A,
+ *     8x8 blocks at a time in AVX2 registers if avx2 is set
+ */
+static void transpose_block(int M, int N, int A[N][M], int B[M][N],
+                            int i0, int i1, int j0, int j1, int avx2)
+{
+    int i, j;
+    int i8 = i0, j8 = j0; // end of the whole 8x8 blocks
+
+    if (avx2)
+    {
+        i8 = i0 + (i1 - i0) / 8 * 8;
+        j8 = j0 + (j1 - j0) / 8 * 8;
+        for (i = i0; i < i8; i += 8)
+        {
+            for (j = j0; j < j8; j += 8)
+                transpose_8x8_avx2(M, N, A, B, i, j);
+        }
+    }
+
+    // whatever the 8x8 blocks left over: the right edge, then the bottom
+    for (i = i0; i < i8; i++)
+    {
+        for (j = j8; j < j1; j++)
+            B[j][i] = A[i][j];
+    }
+    for (i = i8; i < i1; i++)
+    {
+        for (j = j0; j < j1; j++)
+            B[j][i] = A[i][j];
+    }
+}
+
+/*
+ * transpose_8x8_avx2 - Transpose the 8x8 block at row i, column j of A
+ *     in eight ymm registers: 32-bit and 64-bit unpacks interleave pairs
+ *     of rows and 128-bit lane permutes finish the columns
+ */
+__attribute__((target("avx2"))) static void transpose_8x8_avx2(int M, int N, int A[N][M],
+                                                                int B[M][N], int i, int j)
+{
+    __m256i r0 = _mm256_loadu_si256((const __m256i *)&A[i + 0][j]);
+    __m256i r1 = _mm256_loadu_si256((const __m256i *)&A[i + 1][j]);
+    __m256i r2 = _mm256_loadu_si256((const __m256i *)&A[i + 2][j]);
+    __m256i r3 = _mm256_loadu_si256((const __m256i *)&A[i + 3][j]);
+    __m256i r4 = _mm256_loadu_si256((const __m256i *)&A[i + 4][j]);
+    __m256i r5 = _mm256_loadu_si256((const __m256i *)&A[i + 5][j]);
+    __m256i r6 = _mm256_loadu_si256((const __m256i *)&A[i + 6][j]);
+    __m256i r7 = _mm256_loadu_si256((const __m256i *)&A[i + 7][j]);
+
+    // pairs of rows interleaved by element
+    __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+    __m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+    __m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+    __m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+    __m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+
+    // 4-row columns in each 128-bit lane
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    // low lanes hold columns 0-3, high lanes columns 4-7
+    _mm256_storeu_si256((__m256i *)&B[j + 0][i], _mm256_permute2x128_si256(u0, u4, 0x20));
+    _mm256_storeu_si256((__m256i *)&B[j + 1][i], _mm256_permute2x128_si256(u1, u5, 0x20));
+    _mm256_storeu_si256((__m256i *)&B[j + 2][i], _mm256_permute2x128_si256(u2, u6, 0x20));
+    _mm256_storeu_si256((__m256i *)&B[j + 3][i], _mm256_permute2x128_si256(u3, u7, 0x20));
+    _mm256_storeu_si256((__m256i *)&B[j + 4][i], _mm256_permute2x128_si256(u0, u4, 0x31));
+    _mm256_storeu_si256((__m256i *)&B[j + 5][i], _mm256_permute2x128_si256(u1, u5, 0x31));
+    _mm256_storeu_si256((__m256i *)&B[j + 6][i], _mm256_permute2x128_si256(u2, u6, 0x31));
+    _mm256_storeu_si256((__m256i *)&B[j + 7][i], _mm256_permute2x128_si256(u3, u7, 0x31));
+}
+
+/*
+ * transpose_tiled_avx2 - Walk A in TILE x TILE tiles, small enough that a
+ *     tile of A and its image in B stay in L1, each moved 8x8 at a time
+ */
+char transpose_avx2_desc[] = "AVX2 8x8 blocks in tiles";
+void transpose_tiled_avx2(int M, int N, int A[N][M], int B[M][N])
+{
+    int avx2 = use_avx2;
+    int ii, jj;
+
+    for (ii = 0; ii < N; ii += TILE)
+    {
+        for (jj = 0; jj < M; jj += TILE)
+        {
+            transpose_block(M, N, A, B, ii, ii + TILE < N ? ii + TILE : N,
+                            jj, jj + TILE < M ? jj + TILE : M, avx2);
+        }
+    }
+}
+
+/*
+ * transpose_recursive - Halve the longer side of A until the piece fits
+ *     in LEAF x LEAF, so that some level of the recursion fits every
+ *     level of cache without knowing its size; any M x N works
+ */
+static void transpose_rec(int M, int N, int A[N][M], int B[M][N],
+                          int i0, int i1, int j0, int j1)
+{
+    int i, j;
+
+    if (i1 - i0 <= LEAF && j1 - j0 <= LEAF)
+    {
+        for (i = i0; i < i1; i++)
+        {
+            for (j = j0; j < j1; j++)
+                B[j][i] = A[i][j];
+        }
+    }
+    else if (i1 - i0 >= j1 - j0)
+    {
+        int mid = i0 + (i1 - i0) / 2;
+
+        transpose_rec(M, N, A, B, i0, mid, j0, j1);
+        transpose_rec(M, N, A, B, mid, i1, j0, j1);
+    }
+    else
+    {
+        int mid = j0 + (j1 - j0) / 2;
+
+        transpose_rec(M, N, A, B, i0, i1, j0, mid);
+        transpose_rec(M, N, A, B, i0, i1, mid, j1);
+    }
+}
+
+char transpose_recursive_desc[] = "Cache-oblivious recursive";
+void transpose_recursive(int M, int N, int A[N][M], int B[M][N])
+{
+    transpose_rec(M, N, A, B, 0, N, 0, M);
+}
+
+/* The rows of A one thread of transpose_threads transposes */
+struct trans_band
+{
+    int M, N;
+    int *A, *B;
+    int i0, i1;
+};
+
+static void *transpose_band(void *arg)
+{
+    struct trans_band *band = arg;
+    int M = band->M, N = band->N;
+    int (*A)[M] = (int (*)[M])band->A;
+    int (*B)[N] = (int (*)[N])band->B;
+    int avx2 = use_avx2;
+    int ii, jj;
+
+    for (ii = band->i0; ii < band->i1; ii += TILE)
+    {
+        for (jj = 0; jj < M; jj += TILE)
+        {
+            transpose_block(M, N, A, B, ii, ii + TILE < band->i1 ? ii + TILE : band->i1,
+                            jj, jj + TILE < M ? jj + TILE : M, avx2);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * transpose_threads - Split the rows of A into one band of whole tiles per
+ *     core and transpose the bands in parallel; matrices under
+ *     MIN_THREADED_ELEMS aren't worth the threads and run on this one
+ */
+char transpose_threads_desc[] = "Tiled AVX2 on every core";
+void transpose_threads(int M, int N, int A[N][M], int B[M][N])
+{
+    pthread_t threads[MAX_TRANS_THREADS];
+    struct trans_band bands[MAX_TRANS_THREADS];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int tiles = (N + TILE - 1) / TILE;
+    int nthreads, t, started;
+
+    nthreads = cores < 1 ? 1 : cores > MAX_TRANS_THREADS ? MAX_TRANS_THREADS : cores;
+    if (nthreads > tiles)
+        nthreads = tiles;
+    if ((long)M * N < MIN_THREADED_ELEMS)
+        nthreads = 1;
+
+    for (t = 0; t < nthreads; t++)
+    {
+        bands[t] = (struct trans_band){M, N, &A[0][0], &B[0][0],
+                                       tiles * t / nthreads * TILE,
+                                       tiles * (t + 1) / nthreads * TILE};
+        if (bands[t].i1 > N)
+            bands[t].i1 = N;
+    }
+
+    // this thread takes the first band; a band whose thread can't start is done here too
+    for (started = 1; started < nthreads; started++)
+    {
+        if (pthread_create(&threads[started], NULL, transpose_band, &bands[started]))
+            break;
+    }
+    transpose_band(&bands[0]);
+    for (t = started; t < nthreads; t++)
+        transpose_band(&bands[t]);
+    for (t = 1; t < started; t++)
+        pthread_join(threads[t], NULL);
+}
+
 /*
  * registerFunctions - This function registers your transpose
  *     functions with the driver.  At runtime, the driver will
@@ -256,6 +492,12 @@ void registerFunctions()
     registerTransFunction(transpose_64, transpose_desc64);
     registerTransFunction(transpose_32, transpose_32_desc);
     registerTransFunction(transpose_others, transpose_others_desc);
+
+    /* Production kernels */
+    use_avx2 = __builtin_cpu_supports("avx2");
+    registerTransFunction(transpose_tiled_avx2, transpose_avx2_desc);
+    registerTransFunction(transpose_recursive, transpose_recursive_desc);
+    registerTransFunction(transpose_threads, transpose_threads_desc);
 }
 
 /* 
@@ -0,0 +1,320 @@
+/*
+ * tune-trans.c - Search the blocked transpose variants of trans-variant.h
+ * for the one with the fewest misses on each matrix and cache asked for,
+ * and write the winners out as trans-tuned.c: one DEFINE_VARIANT kernel
+ * per (M, N, s, E, b) and the tuned_kernels dispatch table.
+ *
+ * Each variant runs natively with its accesses recorded as tracegen-native
+ * records them, and is replayed on libcsim. Variants that don't transpose
+ * correctly are never picked.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "cachelab.h"
+#include "libcsim.h"
+#include "recorder.h"
+#include "trans-variant.h"
+
+#define MAXN 256
+#define MAX_CONFIGS 64
+#define MAX_VARIANTS 512
+
+/* One matrix and cache to tune for */
+struct tune_config
+{
+    int M, N;
+    int s, E, b;
+};
+
+/* The cases test-trans grades, on its 1KB direct-mapped cache */
+static const struct tune_config default_configs[] = {
+    {32, 32, 5, 1, 5},
+    {64, 64, 5, 1, 5},
+    {61, 67, 5, 1, 5},
+};
+
+/* Block edges tried for both rows and cols */
+static const int block_sizes[] = {2, 4, 8, 12, 16, 17, 18, 20, 23, 24, 32};
+#define NUM_BLOCK_SIZES (int)(sizeof(block_sizes) / sizeof(block_sizes[0]))
+
+/* Laid out like tracegen's matrices, see tracegen.c */
+static int A[MAXN * MAXN] __attribute__((aligned(4096)));
+static int B[MAXN * MAXN] __attribute__((aligned(4096)));
+
+static struct recording rec;
+
+static void print_help(void);
+static int same_config(const struct tune_config *x, const struct tune_config *y);
+static int make_variants(struct trans_variant *variants);
+static long eval_variant(const struct trans_variant *v, const struct tune_config *cfg);
+static void describe_variant(const struct trans_variant *v, char *buf, size_t len);
+static void write_table(FILE *out, const struct tune_config *configs,
+                        const struct trans_variant *best, int n);
+
+int main(int argc, char *argv[])
+{
+    struct tune_config configs[MAX_CONFIGS];
+    struct trans_variant best[MAX_CONFIGS];
+    struct trans_variant variants[MAX_VARIANTS];
+    char *out_name = "trans-tuned.c";
+    int num_configs = 0;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hvc:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (num_configs == MAX_CONFIGS)
+            {
+                printf("At most %d -c configurations\n", MAX_CONFIGS);
+                exit(1);
+            }
+            {
+                struct tune_config *cfg = &configs[num_configs++];
+
+                if (sscanf(optarg, "%d,%d,%d,%d,%d", &cfg->M, &cfg->N,
+                           &cfg->s, &cfg->E, &cfg->b) != 5 ||
+                    cfg->M <= 0 || cfg->N <= 0 || cfg->M > MAXN || cfg->N > MAXN)
+                {
+                    printf("Bad configuration %s, expected M,N,s,E,b with M and N up to %d\n",
+                           optarg, MAXN);
+                    exit(1);
+                }
+                // a repeat would emit a second kernel of the same name
+                for (int c = 0; c < num_configs - 1; c++)
+                {
+                    if (same_config(&configs[c], cfg))
+                    {
+                        num_configs--;
+                        break;
+                    }
+                }
+            }
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+        default:
+            print_help();
+            exit(1);
+        }
+    }
+    if (!num_configs)
+    {
+        num_configs = sizeof(default_configs) / sizeof(default_configs[0]);
+        memcpy(configs, default_configs, sizeof(default_configs));
+    }
+
+    int num_variants = make_variants(variants);
+
+    for (int c = 0; c < num_configs; c++)
+    {
+        const struct tune_config *cfg = &configs[c];
+        struct csim_config cache = {.s = cfg->s, .E = cfg->E, .b = cfg->b};
+        char err[128], desc[64];
+        long best_misses = -1;
+
+        if (csim_check_config(&cache, err, sizeof(err)) < 0)
+        {
+            printf("%s\n", err);
+            exit(1);
+        }
+
+        for (int v = 0; v < num_variants; v++)
+        {
+            long misses = eval_variant(&variants[v], cfg);
+
+            if (verbose)
+            {
+                describe_variant(&variants[v], desc, sizeof(desc));
+                printf("%dx%d s=%d E=%d b=%d %-28s %ld\n", cfg->M, cfg->N,
+                       cfg->s, cfg->E, cfg->b, desc, misses);
+            }
+            // ties go to the variant listed first, the simpler one
+            if (misses >= 0 && (best_misses < 0 || misses < best_misses))
+            {
+                best_misses = misses;
+                best[c] = variants[v];
+            }
+        }
+
+        if (best_misses < 0)
+        {
+            printf("%dx%d s=%d E=%d b=%d: no variant transposed correctly\n",
+                   cfg->M, cfg->N, cfg->s, cfg->E, cfg->b);
+            exit(1);
+        }
+        describe_variant(&best[c], desc, sizeof(desc));
+        printf("%dx%d s=%d E=%d b=%d: %s, misses:%ld\n", cfg->M, cfg->N,
+               cfg->s, cfg->E, cfg->b, desc, best_misses);
+    }
+
+    FILE *out = fopen(out_name, "w");
+    if (!out)
+    {
+        printf("Cannot create %s\n", out_name);
+        exit(1);
+    }
+    write_table(out, configs, best, num_configs);
+    if (fclose(out))
+    {
+        printf("Error writing %s\n", out_name);
+        exit(1);
+    }
+    return 0;
+}
+
+/*
+ * fill variants with the search space, simplest first
+ * return how many there are
+ */
+static int make_variants(struct trans_variant *variants)
+{
+    int n = 0;
+
+    for (int r = 0; r < NUM_BLOCK_SIZES; r++)
+    {
+        for (int c = 0; c < NUM_BLOCK_SIZES; c++)
+        {
+            int rows = block_sizes[r];
+            int cols = block_sizes[c];
+
+            variants[n++] = (struct trans_variant){rows, cols, 0, STAGE_NONE};
+            variants[n++] = (struct trans_variant){rows, cols, 1, STAGE_NONE};
+            if (cols <= MAX_STAGE_COLS)
+                variants[n++] = (struct trans_variant){rows, cols, 0, STAGE_ROW};
+        }
+    }
+    variants[n++] = (struct trans_variant){8, 8, 0, STAGE_SPLIT};
+    return n;
+}
+
+static int same_config(const struct tune_config *x, const struct tune_config *y)
+{
+    return x->M == y->M && x->N == y->N && x->s == y->s && x->E == y->E && x->b == y->b;
+}
+
+/*
+ * run variant v on a random cfg->N x cfg->M matrix
+ * return its misses on the cfg cache, -1 if it didn't transpose correctly
+ */
+static long eval_variant(const struct trans_variant *v, const struct tune_config *cfg)
+{
+    int M = cfg->M, N = cfg->N;
+    int (*a)[M] = (int (*)[M])A;
+    int (*b)[N] = (int (*)[N])B;
+    struct csim_config cache = {.s = cfg->s, .E = cfg->E, .b = cfg->b};
+    struct csim_stats stats;
+
+    initMatrix(M, N, a, b);
+    record_start(&rec, __builtin_frame_address(0));
+    run_variant(v, M, N, a, b);
+    if (record_stop() < 0)
+    {
+        printf("Out of memory recording a %dx%d transpose\n", M, N);
+        exit(1);
+    }
+
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < M; j++)
+        {
+            if (a[i][j] != b[j][i])
+                return -1;
+        }
+    }
+
+    csim_t *sim = csim_create(&cache);
+    if (!sim)
+    {
+        printf("Out of memory simulating the cache\n");
+        exit(1);
+    }
+    csim_access_batch(sim, rec.addrs, rec.ops, rec.n);
+    csim_stats(sim, &stats);
+    csim_destroy(sim);
+    return stats.misses;
+}
+
+static void describe_variant(const struct trans_variant *v, char *buf, size_t len)
+{
+    if (v->stage == STAGE_SPLIT)
+        snprintf(buf, len, "8x8 blocks, 4x4 quadrants");
+    else
+        snprintf(buf, len, "%dx%d blocks%s", v->rows, v->cols,
+                 v->stage == STAGE_ROW ? ", staged rows" : v->defer_diag ? ", diagonal last" : "");
+}
+
+static const char *stage_name(int stage)
+{
+    return stage == STAGE_ROW ? "STAGE_ROW" : stage == STAGE_SPLIT ? "STAGE_SPLIT" : "STAGE_NONE";
+}
+
+/*
+ * write the winning kernel of every configuration, the dispatch table
+ * over them and find_tuned_kernel as C source
+ */
+static void write_table(FILE *out, const struct tune_config *configs,
+                        const struct trans_variant *best, int n)
+{
+    char desc[64];
+
+    fprintf(out, "/*\n * trans-tuned.c - Transpose kernels picked by tune-trans, do not edit\n */\n\n");
+    fprintf(out, "#include <stddef.h>\n#include \"trans-variant.h\"\n\n");
+    for (int c = 0; c < n; c++)
+    {
+        const struct tune_config *cfg = &configs[c];
+
+        fprintf(out, "DEFINE_VARIANT(tuned_%dx%d_s%d_E%d_b%d, %d, %d, %d, %s)\n",
+                cfg->M, cfg->N, cfg->s, cfg->E, cfg->b, best[c].rows, best[c].cols,
+                best[c].defer_diag, stage_name(best[c].stage));
+    }
+
+    fprintf(out, "\nconst struct tuned_kernel tuned_kernels[] = {\n");
+    for (int c = 0; c < n; c++)
+    {
+        const struct tune_config *cfg = &configs[c];
+
+        describe_variant(&best[c], desc, sizeof(desc));
+        fprintf(out, "    {%d, %d, %d, %d, %d, tuned_%dx%d_s%d_E%d_b%d, \"Tuned: %s\"},\n",
+                cfg->M, cfg->N, cfg->s, cfg->E, cfg->b,
+                cfg->M, cfg->N, cfg->s, cfg->E, cfg->b, desc);
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "const int num_tuned_kernels = sizeof(tuned_kernels) / sizeof(tuned_kernels[0]);\n\n");
+
+    fprintf(out, "const struct tuned_kernel *find_tuned_kernel(int M, int N, int s, int E, int b)\n");
+    fprintf(out, "{\n");
+    fprintf(out, "    for (int i = 0; i < num_tuned_kernels; i++)\n");
+    fprintf(out, "    {\n");
+    fprintf(out, "        const struct tuned_kernel *k = &tuned_kernels[i];\n\n");
+    fprintf(out, "        if (k->M == M && k->N == N && k->s == s && k->E == E && k->b == b)\n");
+    fprintf(out, "            return k;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    return NULL;\n");
+    fprintf(out, "}\n");
+}
+
+static void print_help(void)
+{
+    printf("Usage: ./tune-trans [-hv] [-c <M,N,s,E,b>]... [-o <file>]\n");
+    printf("Options:\n");
+    printf("  -h              Print this help message.\n");
+    printf("  -v              Print the misses of every variant.\n");
+    printf("  -c <M,N,s,E,b>  Tune an MxN transpose for a cache of 2^s sets of E\n");
+    printf("                  lines of 2^b bytes; repeatable. Default: the three\n");
+    printf("                  test-trans cases on s=5 E=1 b=5.\n");
+    printf("  -o <file>       Kernels and dispatch table to write (default trans-tuned.c).\n\n");
+    printf("Examples:\n");
+    printf("  linux>  ./tune-trans\n");
+    printf("  linux>  ./tune-trans -c 64,64,6,2,5 -c 61,67,6,2,5 -o trans-tuned.c\n");
+}
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "config.h"
 #include "memlib.h"
 
 team_t team = {
@@ -43,13 +44,18 @@ team_t team = {
 #define CHECKHEAP(verbose)
 #endif
 
+/* Geometric slack for blocks mm_realloc keeps growing: when a block it has
+ * grown before grows again, it reserves another 1/REALLOC_SLACK of the new
+ * size past the request, so n small growths take O(log n) copies or sbrk
+ * calls in all. The reserve counts against utilization; 0 turns it off. */
+#define REALLOC_SLACK 8
+
 /* $begin mallocmacros */
 /* Basic constants and macros */
 #define WSIZE 4                /* Word and header/footer size (bytes) */
 #define DSIZE 8                /* Double word size (bytes) */
 #define CHUNKSIZE (1 << 12)    /* Extend heap by this amount (bytes) */
 #define INITCHUNKSIZE (1 << 6) /* Initialize heap by this amount (bytes) */
-#define LIST_MAX 16            /* The max capcity of the free list */
 #define ALIGNMENT 8            /* single (4) or double word (8) alignment */
 
 /* rounds up to the nearest multiple of ALIGNMENT */
@@ -62,6 +68,10 @@ team_t team = {
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
+/* Header bit set when the previous block is allocated. Allocated blocks
+ * have no footer, so only a free previous block can be found from bp */
+#define PREV_ALLOC 0x2
+
 /* Read and write a word at address p */
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
@@ -69,30 +79,87 @@ team_t team = {
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* Header bit set in blocks mm_realloc has grown, see REALLOC_SLACK */
+#define REALLOC_TAG 0x4
+#define GET_TAG(p) (GET(p) & REALLOC_TAG)
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Set or clear the prev-alloc bit in the header of block bp */
+#define SET_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) & ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and footer (free only) */
 #define HDRP(bp) ((char *)(bp)-WSIZE)                         // hdrp
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)  // ftrp
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous (free) blocks */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp)-GET_SIZE(((char *)(bp)-DSIZE)))
 
-/* for explict linkedlist */
+/* for explict linkedlist
+ * Links are 32-bit offsets from heap_base, so free blocks stay 16 bytes
+ * on 64-bit builds too. Offset 0 is the alignment padding word, never a
+ * block, and stands for NULL. */
 #define PRED_PTR(ptr) ((char *)(ptr))
 #define SUCC_PTR(ptr) ((char *)(ptr) + WSIZE)
 
-#define PRED(ptr) (*(char **)(ptr))
-#define SUCC(ptr) (*(char **)(SUCC_PTR(ptr)))
-
-#define SET_PTR(p, ptr) (*(unsigned int *)(p) = (unsigned int)(ptr))
+#define OFF_TO_PTR(off) ((off) ? heap_base + (off) : NULL)
+#define PTR_TO_OFF(ptr) ((ptr) ? (unsigned int)((char *)(ptr) - heap_base) : 0)
+
+#define PRED(ptr) OFF_TO_PTR(GET(PRED_PTR(ptr)))
+#define SUCC(ptr) OFF_TO_PTR(GET(SUCC_PTR(ptr)))
+
+#define SET_PTR(p, ptr) PUT(p, PTR_TO_OFF(ptr))
+
+/* Two-level segregated fit (TLSF) classes.
+ * A first-level class holds the sizes sharing a most significant bit,
+ * split into SL_COUNT second-level classes of equal width. Sizes below
+ * SMALL_BLOCK share first-level class 0, one 8-byte size per class. */
+#define SL_LOG2 4                       /* log2 of second-level classes */
+#define SL_COUNT (1 << SL_LOG2)         /* second-level classes per first */
+#define FL_SHIFT (SL_LOG2 + 3)          /* log2 of SMALL_BLOCK */
+#define SMALL_BLOCK (1 << FL_SHIFT)     /* smallest size of first level 1 */
+#define FL_COUNT (32 - FL_SHIFT + 1)    /* first-level classes of 32-bit sizes */
+
+/* Most significant bit of size, size > 0 */
+#define FLS(size) (31 - __builtin_clz((unsigned int)(size)))
+
+/* Slab front-end for requests of up to SLAB_MAX bytes.
+ * A run is an allocated block of RUN_SIZE bytes whose payload starts on a
+ * RUN_SIZE boundary from heap_base. It holds objects of one size class,
+ * without headers, after RUN_HDR bytes of metadata: the pred/succ links of
+ * its class list, the object size, the free object count, and a bitmap
+ * with a set bit per free object. */
+#define SLAB_MAX 256                            /* largest slab request */
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)     /* one class per 8 bytes */
+#define RUN_SIZE (1 << 12)                      /* run block size (bytes) */
+#define RUN_PAGES (MAX_HEAP / RUN_SIZE)         /* run boundaries in the heap */
+#define RUN_MAP_WORDS 16                        /* bitmap words, 512 objects */
+#define RUN_HDR (4 * WSIZE + RUN_MAP_WORDS * WSIZE)
+
+/* Given run, compute address of its metadata and objects */
+#define RUN_OBJSIZE(run) ((char *)(run) + 2 * WSIZE)
+#define RUN_NFREE(run) ((char *)(run) + 3 * WSIZE)
+#define RUN_MAP(run) ((char *)(run) + 4 * WSIZE)
+#define RUN_OBJ(run, i) ((char *)(run) + RUN_HDR + (i)*GET(RUN_OBJSIZE(run)))
+#define RUN_NOBJS(objsize) ((RUN_SIZE - WSIZE - RUN_HDR) / (objsize))
+
+/* Run index of bp, and the run bp lies in if bit RUN_INDEX of run_map is set */
+#define RUN_INDEX(bp) (((char *)(bp) - heap_base) / RUN_SIZE)
+#define RUN_OF(bp) (heap_base + RUN_INDEX(bp) * RUN_SIZE)
+#define IS_RUN(bp) (run_map[RUN_INDEX(bp) / 32] & (1u << (RUN_INDEX(bp) % 32)))
 
 /* $end mallocmacros */
 
 /* Global variables */
-static char *heap_listp = 0;    /* Pointer to first block */
-void *seg_free_lists[LIST_MAX]; /* Store free list */
-static char *rover;             /* Next fit rover */
+static char *heap_listp = 0;               /* Pointer to first block */
+static char *heap_base;                   /* mem_heap_lo(), links are offsets */
+void *seg_free_lists[FL_COUNT][SL_COUNT]; /* Store free list */
+static unsigned int fl_bitmap;            /* Bit fl: class fl has a free block */
+static unsigned int sl_bitmap[FL_COUNT];  /* Bit sl: list [fl][sl] is not empty */
+static char *slab_runs[SLAB_CLASSES];     /* Runs with free objects per class */
+static unsigned int run_map[RUN_PAGES / 32]; /* Bit i: a run starts at run index i */
 
 /* Function prototypes for internal helper routines */
 static void mm_check();
@@ -102,30 +169,43 @@ static void *place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
 static void printblock(void *bp);
-static void printlist(void *i, long size);
+static void printlist(void *i, int fl, int sl);
 static int checkblock(void *bp);
-static void checklist(void *i, size_t tar);
+static void checklist(void *i, int fl, int sl);
+static void mapping(size_t size, int *fl, int *sl);
+static void *slab_alloc(size_t size);
+static void slab_free(void *bp);
+static void *new_run(size_t objsize);
+static void *carve_run(void *bp);
+static void checkrun(void *run);
 static void insert_node(void *bp, size_t size);
 static void delete_node(void *bp);
 static size_t get_asize(size_t size);
 static void *realloc_coalesce(void *bp, size_t newSize, int *isNextFree);
 static void realloc_place(void *bp, size_t asize);
+static size_t realloc_slack(size_t asize);
+static int realloc_extend(void *bp, size_t asize);
 
 /*
  * mm_init - initialize the malloc package.
  */
 int mm_init(void) {
-    int i;
+    int fl, sl, i;
     /* initiliaze seg_free_lists */
-    for (i = 0; i < LIST_MAX; i++) {
-        seg_free_lists[i] = NULL;
+    for (fl = 0; fl < FL_COUNT; fl++) {
+        for (sl = 0; sl < SL_COUNT; sl++) seg_free_lists[fl][sl] = NULL;
+        sl_bitmap[fl] = 0;
     }
+    fl_bitmap = 0;
+    for (i = 0; i < SLAB_CLASSES; i++) slab_runs[i] = NULL;
+    for (i = 0; i < RUN_PAGES / 32; i++) run_map[i] = 0;
     /* Create the initial empty heap */
     if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1) return -1;
+    heap_base = mem_heap_lo();
     PUT(heap_listp, 0);                            /* Alignment padding */
-    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue header */
-    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
-    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));     /* Epilogue header */
+    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1) | PREV_ALLOC); /* Prologue header */
+    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));              /* Prologue footer */
+    PUT(heap_listp + (3 * WSIZE), PACK(0, 1) | PREV_ALLOC);     /* Epilogue header */
     heap_listp += (2 * WSIZE);
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
@@ -140,7 +220,6 @@ int mm_init(void) {
  */
 void *mm_malloc(size_t size) {
     size_t asize; /* Adjusted block size */
-    size_t search;
     size_t extendsize; /* Amount to extend heap if no fit */
     char *bp = NULL;
 
@@ -148,25 +227,18 @@ void *mm_malloc(size_t size) {
         mm_init();
     }
 
-    /* Ignore spurious requests */
-    if (size == 0) return NULL;
+    /* Ignore spurious requests, and ones no 32-bit header or heap can hold */
+    if (size == 0 || size > MAX_HEAP) return NULL;
+
+    if (size <= SLAB_MAX) {
+        bp = slab_alloc(size);
+        CHECKHEAP(1);
+        return bp;
+    }
 
     /* Adjust block size to include overhead and alignment reqs. */
     asize = get_asize(size);
-    search = asize;
-    int target;
-    for (target = 0; target < LIST_MAX; target++, search >>= 1) {
-        /* find target seg_free_list */
-        if ((search > 1) || (seg_free_lists[target] == NULL)) continue;
-        char *i = seg_free_lists[target];
-        for (; i != NULL; i = SUCC(i)) {
-            if (GET_SIZE(HDRP(i)) < asize) continue;
-            bp = i;
-            break;
-        }
-        if (bp != NULL) break;
-    }
-    if (bp == NULL) {
+    if ((bp = find_fit(asize)) == NULL) {
         /* No fit found. Get more memory and place the block */
         extendsize = MAX(asize, CHUNKSIZE);
         if ((bp = extend_heap(extendsize / WSIZE)) == NULL) return NULL;
@@ -180,9 +252,14 @@ void *mm_malloc(size_t size) {
  * mm_free - Freeing a block does nothing.
  */
 void mm_free(void *bp) {
+    if (IS_RUN(bp)) {
+        slab_free(bp);
+        CHECKHEAP(1);
+        return;
+    }
     size_t size = GET_SIZE(HDRP(bp));
 
-    PUT(HDRP(bp), PACK(size, 0));
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)));
     PUT(FTRP(bp), PACK(size, 0));
     coalesce(bp);
     CHECKHEAP(1);
@@ -190,16 +267,18 @@ void mm_free(void *bp) {
 
 /*
  * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ *     Blocks before a free block are allocated, so the coalesced block
+ *     always has PREV_ALLOC set, and the block after it never does.
  */
 static void *coalesce(void *bp) {
-    size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
     if (prev_alloc && !next_alloc) { /* Case 2 */
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         delete_node(NEXT_BLKP(bp));
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, 0) | PREV_ALLOC);
         PUT(FTRP(bp), PACK(size, 0));
     }
 
@@ -207,7 +286,7 @@ static void *coalesce(void *bp) {
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         delete_node(PREV_BLKP(bp));
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0) | PREV_ALLOC);
         bp = PREV_BLKP(bp);
     }
 
@@ -215,10 +294,11 @@ static void *coalesce(void *bp) {
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
         delete_node(PREV_BLKP(bp));
         delete_node(NEXT_BLKP(bp));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0) | PREV_ALLOC);
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
     }
+    CLR_PREV_ALLOC(NEXT_BLKP(bp));
     insert_node(bp, size);
     return bp;
 }
@@ -232,12 +312,27 @@ void *mm_realloc(void *ptr, size_t size) {
         mm_free(ptr);
         return NULL;
     }
+    if (size > MAX_HEAP) return NULL; /* ptr is left as it was */
 
     void *newptr;
     size_t asize, oldsize;
+    if (IS_RUN(ptr)) { /* slab object: keep it if size still fits */
+        oldsize = GET(RUN_OBJSIZE(RUN_OF(ptr)));
+        if (size <= oldsize) return ptr;
+        if ((newptr = mm_malloc(size)) == NULL) return NULL;
+        memcpy(newptr, ptr, oldsize);
+        mm_free(ptr);
+        CHECKHEAP(1);
+        return newptr;
+    }
     oldsize = GET_SIZE(HDRP(ptr));
     asize = get_asize(size);
-    if (oldsize < asize) {
+    if (oldsize < asize && GET_TAG(HDRP(ptr)))
+        asize += realloc_slack(asize);
+    if (oldsize < asize && realloc_extend(ptr, asize)) {
+        CHECKHEAP(1);
+        return ptr;
+    } else if (oldsize < asize) {
         int isNextFree;
         char *bp = realloc_coalesce(ptr, asize, &isNextFree);
         if (isNextFree == 1) { /*next block is free*/
@@ -246,12 +341,13 @@ void *mm_realloc(void *ptr, size_t size) {
         /* previous block is free
          * move the point to new address,and move the payload */
         else if (isNextFree == 0 && bp != ptr) {
-            memcpy(bp, ptr, size);
+            memmove(bp, ptr, oldsize - WSIZE);
             realloc_place(bp, asize);
         } else {
             /*realloc_coalesce is fail*/
-            newptr = mm_malloc(size);
-            memcpy(newptr, ptr, size);
+            if ((newptr = mm_malloc(asize - WSIZE)) == NULL) return NULL;
+            memcpy(newptr, ptr, oldsize - WSIZE);
+            if (!IS_RUN(newptr)) PUT(HDRP(newptr), GET(HDRP(newptr)) | REALLOC_TAG);
             mm_free(ptr);
             CHECKHEAP(1);
             return newptr;
@@ -267,18 +363,54 @@ void *mm_realloc(void *ptr, size_t size) {
     return ptr;
 }
 
+/*
+ * get_asize - Block size for size bytes of payload: a header, no footer,
+ *     and room for the links and footer once the block is free
+ */
 static size_t get_asize(size_t size) {
     size_t asize;
-    if (size <= DSIZE) {
+    if (size <= DSIZE + WSIZE) {
         asize = 2 * (DSIZE);
     } else {
-        asize = ALIGN(size + DSIZE);
+        asize = ALIGN(size + WSIZE);
     }
     return asize;
 }
 
+/*
+ * realloc_slack - Bytes to reserve past a regrown block of asize bytes
+ */
+static size_t realloc_slack(size_t asize) {
+    return REALLOC_SLACK ? ALIGN(asize / REALLOC_SLACK) : 0;
+}
+
+/*
+ * realloc_extend - Grow bp to asize bytes in place with mem_sbrk if it is
+ *     the last block before the epilogue, or only a free block follows it.
+ *     Return 1 on success, 0 if bp isn't at the heap end or sbrk failed
+ */
+static int realloc_extend(void *bp, size_t asize) {
+    char *next = NEXT_BLKP(bp);
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (GET_SIZE(HDRP(next)) != 0 && !GET_ALLOC(HDRP(next))) {
+        if (GET_SIZE(HDRP(NEXT_BLKP(next))) != 0) return 0;
+        size += GET_SIZE(HDRP(next));
+        if (size >= asize) return 0; /* realloc_coalesce splits nothing off */
+        if (mem_sbrk(asize - size) == (void *)-1) return 0;
+        delete_node(next);
+    } else if (GET_SIZE(HDRP(next)) != 0) {
+        return 0;
+    } else if (mem_sbrk(asize - size) == (void *)-1) {
+        return 0;
+    }
+    PUT(HDRP(bp), PACK(asize, 1) | GET_PREV_ALLOC(HDRP(bp)) | REALLOC_TAG);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1) | PREV_ALLOC);
+    return 1;
+}
+
 static void *realloc_coalesce(void *bp, size_t newSize, int *isNextFree) {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
     *isNextFree = 0;
@@ -287,26 +419,23 @@ static void *realloc_coalesce(void *bp, size_t newSize, int *isNextFree) {
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         if (size >= newSize) {
             delete_node(NEXT_BLKP(bp));
-            PUT(HDRP(bp), PACK(size, 1));
-            PUT(FTRP(bp), PACK(size, 1));
+            PUT(HDRP(bp), PACK(size, 1) | PREV_ALLOC | REALLOC_TAG);
             *isNextFree = 1;
         }
     } else if (!prev_alloc && next_alloc) {
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         if (size >= newSize) {
             delete_node(PREV_BLKP(bp));
-            PUT(FTRP(bp), PACK(size, 1));
-            PUT(HDRP(PREV_BLKP(bp)), PACK(size, 1));
             bp = PREV_BLKP(bp);
+            PUT(HDRP(bp), PACK(size, 1) | PREV_ALLOC | REALLOC_TAG);
         }
     } else if (!prev_alloc && !next_alloc) {
         size += GET_SIZE(FTRP(NEXT_BLKP(bp))) + GET_SIZE(HDRP(PREV_BLKP(bp)));
         if (size >= newSize) {
             delete_node(PREV_BLKP(bp));
             delete_node(NEXT_BLKP(bp));
-            PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 1));
-            PUT(HDRP(PREV_BLKP(bp)), PACK(size, 1));
             bp = PREV_BLKP(bp);
+            PUT(HDRP(bp), PACK(size, 1) | PREV_ALLOC | REALLOC_TAG);
         }
     }
     return bp;
@@ -314,8 +443,8 @@ static void *realloc_coalesce(void *bp, size_t newSize, int *isNextFree) {
 
 static void realloc_place(void *bp, size_t asize) {
     size_t csize = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(csize, 1));
-    PUT(FTRP(bp), PACK(csize, 1));
+    PUT(HDRP(bp), PACK(csize, 1) | GET_PREV_ALLOC(HDRP(bp)) | GET_TAG(HDRP(bp)));
+    SET_PREV_ALLOC(NEXT_BLKP(bp));
 }
 
 /*
@@ -338,22 +467,32 @@ void checkheap(int verbose) {
     int pre_free = 0;
     for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
         if (verbose) printblock(bp);
-        int cur_free = checkblock(bp);
+        int cur_free = !checkblock(bp);
+        if (IS_RUN(bp)) checkrun(bp);
         /* no contiguous free blocks */
         if (pre_free && cur_free) {
             printf("Contiguous free blocks\n");
         }
+        if ((!GET_PREV_ALLOC(HDRP(bp))) != pre_free)
+            printf("Error: %p prev-alloc bit error\n", bp);
+        pre_free = cur_free;
     }
     /* list level */
-    int i = 0, tarsize = 1;
-    for (; i < LIST_MAX; i++) {
-        if (verbose) printlist(seg_free_lists[i], tarsize);
-        checklist(seg_free_lists[i], tarsize);
-        tarsize <<= 1;
+    int fl, sl;
+    for (fl = 0; fl < FL_COUNT; fl++) {
+        if (!sl_bitmap[fl] != !(fl_bitmap & (1u << fl)))
+            printf("Error: first-level bitmap error\n");
+        for (sl = 0; sl < SL_COUNT; sl++) {
+            if (!seg_free_lists[fl][sl] != !(sl_bitmap[fl] & (1u << sl)))
+                printf("Error: second-level bitmap error\n");
+            if (verbose) printlist(seg_free_lists[fl][sl], fl, sl);
+            checklist(seg_free_lists[fl][sl], fl, sl);
+        }
     }
 
     if (verbose) printblock(bp);
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))) ||
+        (!GET_PREV_ALLOC(HDRP(bp))) != pre_free)
         printf("Bad epilogue header\n");
 }
 
@@ -362,14 +501,23 @@ static void printblock(void *bp) {
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
+    if (hsize == 0 || halloc) {
+        fsize = falloc = 0;
+    } else {
+        fsize = GET_SIZE(FTRP(bp));
+        falloc = GET_ALLOC(FTRP(bp));
+    }
 
     if (hsize == 0) {
         printf("%p: EOL\n", bp);
         return;
     }
 
+    if (halloc) {
+        printf("%p: header: [%ld:%c%s]\n", bp, hsize, 'a',
+               (GET_PREV_ALLOC(HDRP(bp)) ? "" : " prev f"));
+        return;
+    }
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp, hsize,
            (halloc ? 'a' : 'f'), fsize, (falloc ? 'a' : 'f'));
 }
@@ -377,8 +525,9 @@ static void printblock(void *bp) {
 static int checkblock(void *bp) {
     /* IF block not aligned */
     if ((size_t)bp % 8) printf("Error: %p is not doubleword aligned\n", bp);
-    /* IF header and footer not match */
-    if (GET(HDRP(bp)) != GET(FTRP(bp)))
+    /* IF header and footer of a free block not match */
+    if (!GET_ALLOC(HDRP(bp)) &&
+        (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)) || GET_ALLOC(FTRP(bp))))
         printf("Error: header does not match footer\n");
     size_t size = GET_SIZE(HDRP(bp));
     /* IF size not valid */
@@ -387,34 +536,50 @@ static int checkblock(void *bp) {
     return GET_ALLOC(HDRP(bp));
 }
 
-static void printlist(void *i, long size) {
+static void printlist(void *i, int fl, int sl) {
     long int hsize, halloc;
 
     for (; i != NULL; i = SUCC(i)) {
         hsize = GET_SIZE(HDRP(i));
         halloc = GET_ALLOC(HDRP(i));
-        printf("[listnode %ld] %p: header: [%ld:%c] prev: [%p]  next: [%p]\n",
-               size, i, hsize, (halloc ? 'a' : 'f'), PRED(i), SUCC(i));
+        printf("[listnode %d:%d] %p: header: [%ld:%c] prev: [%p]  next: [%p]\n",
+               fl, sl, i, hsize, (halloc ? 'a' : 'f'), PRED(i), SUCC(i));
     }
 }
 
-static void checklist(void *i, size_t tar) {
+static void checklist(void *i, int fl, int sl) {
     void *pre = NULL;
     long int hsize, halloc;
+    int hfl, hsl;
     for (; i != NULL; i = SUCC(i)) {
         if (PRED(i) != pre) printf("Error: pred point error\n");
         if (pre != NULL && SUCC(pre) != i) printf("Error: succ point error\n");
         hsize = GET_SIZE(HDRP(i));
         halloc = GET_ALLOC(HDRP(i));
         if (halloc) printf("Error: list node should be free\n");
-        if (pre != NULL && (GET_SIZE(HDRP(pre)) > hsize))
-            printf("Error: list size order error\n");
-        if (hsize < tar || ((tar != (1 << 15)) && (hsize > (tar << 1) - 1)))
-            printf("Error: list node size error\n");
+        mapping(hsize, &hfl, &hsl);
+        if (hfl != fl || hsl != sl) printf("Error: list node size error\n");
         pre = i;
     }
 }
 
+/*
+ * checkrun - Check the metadata of a slab run
+ */
+static void checkrun(void *run) {
+    size_t objsize = GET(RUN_OBJSIZE(run));
+    int i, nfree = 0;
+
+    if (GET_SIZE(HDRP(run)) < RUN_SIZE || !GET_ALLOC(HDRP(run)))
+        printf("Error: run %p is not an allocated run block\n", run);
+    if (objsize == 0 || objsize > SLAB_MAX || objsize % ALIGNMENT)
+        printf("Error: run %p object size error\n", run);
+    for (i = 0; i < RUN_MAP_WORDS; i++)
+        nfree += __builtin_popcount(GET(RUN_MAP(run) + i * WSIZE));
+    if (nfree != GET(RUN_NFREE(run)))
+        printf("Error: run %p free count does not match its bitmap\n", run);
+}
+
 /*
  * extend_heap - Extend heap with free block and return its block pointer
  */
@@ -428,8 +593,8 @@ static void *extend_heap(size_t words) {
 
     /* Initialize free block header/footer and the epilogue header */
 
-    /* Free block header */
-    PUT(HDRP(bp), PACK(size, 0));
+    /* Free block header, over the old epilogue and its prev-alloc bit */
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)));
 
     /* Free block footer */
     PUT(FTRP(bp), PACK(size, 0));
@@ -449,68 +614,202 @@ static void *place(void *bp, size_t asize) {
     size_t size = GET_SIZE(HDRP(bp));
     delete_node(bp);
     if ((size - asize) < (2 * DSIZE)) {
-        PUT(HDRP(bp), PACK(size, 1));
-        PUT(FTRP(bp), PACK(size, 1));
+        PUT(HDRP(bp), PACK(size, 1) | PREV_ALLOC);
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
     } else if (asize >= 96) {
-        PUT(HDRP(bp), PACK(size - asize, 0));
+        PUT(HDRP(bp), PACK(size - asize, 0) | PREV_ALLOC);
         PUT(FTRP(bp), PACK(size - asize, 0));
         PUT(HDRP(NEXT_BLKP(bp)), PACK(asize, 1));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(asize, 1));
+        SET_PREV_ALLOC(NEXT_BLKP(NEXT_BLKP(bp)));
         insert_node(bp, size - asize);
         return NEXT_BLKP(bp);
     } else {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
-        PUT(HDRP(NEXT_BLKP(bp)), PACK(size - asize, 0));
+        PUT(HDRP(bp), PACK(asize, 1) | PREV_ALLOC);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(size - asize, 0) | PREV_ALLOC);
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size - asize, 0));
         insert_node(NEXT_BLKP(bp), size - asize);
     }
     return bp;
 }
 
-static void insert_node(void *bp, size_t size) {
-    int tar = 0;
-    size_t j;
-    for (j = size; (j > 1) && (tar < LIST_MAX - 1);) {
-        j >>= 1;
-        tar++;
-    }
-    char *i = seg_free_lists[tar];
-    char *pre = NULL;
-    while ((i != NULL) && (size > GET_SIZE(HDRP(i)))) {
-        pre = i;
-        i = SUCC(i);
-    }  // i should be first node size >= input size
-    if (i == NULL && pre == NULL) {  // empty list
-        seg_free_lists[tar] = bp;
-        SET_PTR(PRED_PTR(bp), NULL);
-        SET_PTR(SUCC_PTR(bp), NULL);
-    } else if (i == NULL && pre != NULL) {  // add the last
-        SET_PTR(PRED_PTR(bp), pre);
-        SET_PTR(SUCC_PTR(bp), NULL);
-        SET_PTR(SUCC_PTR(pre), bp);
-    } else if (pre == NULL) {  // add the first
-        seg_free_lists[tar] = bp;
-        SET_PTR(PRED_PTR(i), bp);
-        SET_PTR(SUCC_PTR(bp), i);
-        SET_PTR(PRED_PTR(bp), NULL);
+/*
+ * slab_alloc - Take the first free object of the class of size bytes
+ */
+static void *slab_alloc(size_t size) {
+    int class = (size - 1) / ALIGNMENT;
+    char *run = slab_runs[class];
+    char *map;
+    unsigned int bits;
+
+    if (run == NULL && (run = new_run((class + 1) * ALIGNMENT)) == NULL)
+        return NULL;
+    for (map = RUN_MAP(run); GET(map) == 0; map += WSIZE)
+        ;
+    bits = GET(map);
+    PUT(map, bits & (bits - 1));
+    PUT(RUN_NFREE(run), GET(RUN_NFREE(run)) - 1);
+    if (GET(RUN_NFREE(run)) == 0) {  // full, off the class list
+        slab_runs[class] = SUCC(run);
+        if (SUCC(run) != NULL) SET_PTR(PRED_PTR(SUCC(run)), NULL);
+    }
+    return RUN_OBJ(run, (map - RUN_MAP(run)) / WSIZE * 32 + __builtin_ctz(bits));
+}
+
+/*
+ * slab_free - Return object bp to its run, and an empty run to the heap
+ *     unless it is the only one left with free objects in its class
+ */
+static void slab_free(void *bp) {
+    char *run = RUN_OF(bp);
+    size_t objsize = GET(RUN_OBJSIZE(run));
+    int class = objsize / ALIGNMENT - 1;
+    size_t i = ((char *)bp - RUN_OBJ(run, 0)) / objsize;
+    size_t nfree = GET(RUN_NFREE(run)) + 1;
+
+    PUT(RUN_MAP(run) + i / 32 * WSIZE,
+        GET(RUN_MAP(run) + i / 32 * WSIZE) | (1u << (i % 32)));
+    PUT(RUN_NFREE(run), nfree);
+    if (nfree == 1) {  // was full, back on the class list
+        SET_PTR(PRED_PTR(run), NULL);
+        SET_PTR(SUCC_PTR(run), slab_runs[class]);
+        if (slab_runs[class] != NULL) SET_PTR(PRED_PTR(slab_runs[class]), run);
+        slab_runs[class] = run;
+    }
+    if (nfree < RUN_NOBJS(objsize) ||
+        (PRED(run) == NULL && SUCC(run) == NULL))
+        return;
+
+    if (PRED(run) == NULL) {
+        slab_runs[class] = SUCC(run);
+        SET_PTR(PRED_PTR(SUCC(run)), NULL);
     } else {
-        SET_PTR(PRED_PTR(bp), pre);
-        SET_PTR(SUCC_PTR(bp), i);
-        SET_PTR(PRED_PTR(i), bp);
-        SET_PTR(SUCC_PTR(pre), bp);
+        SET_PTR(SUCC_PTR(PRED(run)), SUCC(run));
+        if (SUCC(run) != NULL) SET_PTR(PRED_PTR(SUCC(run)), PRED(run));
     }
+    run_map[RUN_INDEX(run) / 32] &= ~(1u << (RUN_INDEX(run) % 32));
+    PUT(HDRP(run), PACK(GET_SIZE(HDRP(run)), 0) | GET_PREV_ALLOC(HDRP(run)));
+    PUT(FTRP(run), PACK(GET_SIZE(HDRP(run)), 0));
+    coalesce(run);
 }
-static void delete_node(void *bp) {
-    size_t size = GET_SIZE(HDRP(bp)), j;
-    int tar = 0;
-    for (j = size; (j > 1) && (tar < LIST_MAX - 1); j >>= 1) {
-        tar++;
+
+/*
+ * new_run - Carve a run for objects of objsize bytes out of a free block,
+ *     extending the heap if none has room, and put it on its class list
+ */
+static void *new_run(size_t objsize) {
+    char *bp, *run;
+    size_t i, nobjs = RUN_NOBJS(objsize);
+
+    /* A free block of 2 runs always has room for an aligned one */
+    if ((bp = find_fit(RUN_SIZE)) == NULL || (run = carve_run(bp)) == NULL) {
+        if ((bp = find_fit(2 * RUN_SIZE + 2 * DSIZE)) != NULL) {
+            run = carve_run(bp);
+        } else {
+            /* Extend so that the run ends the heap, after the free tail */
+            char *end = (char *)mem_heap_hi() + 1;
+            bp = GET_PREV_ALLOC(HDRP(end)) ? end : PREV_BLKP(end);
+            run = heap_base + (RUN_INDEX(bp - 1) + 1) * RUN_SIZE;
+            if (run != bp && run - bp < 2 * DSIZE) run += RUN_SIZE;
+            if ((bp = extend_heap((run + RUN_SIZE - end) / WSIZE)) == NULL)
+                return NULL;
+            run = carve_run(bp);
+        }
+    }
+
+    PUT(RUN_OBJSIZE(run), objsize);
+    PUT(RUN_NFREE(run), nobjs);
+    for (i = 0; i < RUN_MAP_WORDS; i++) {
+        PUT(RUN_MAP(run) + i * WSIZE,
+            nobjs >= 32 * (i + 1) ? ~0u
+            : nobjs > 32 * i      ? (1u << (nobjs - 32 * i)) - 1
+                                  : 0);
+    }
+    run_map[RUN_INDEX(run) / 32] |= 1u << (RUN_INDEX(run) % 32);
+    SET_PTR(PRED_PTR(run), NULL);
+    SET_PTR(SUCC_PTR(run), NULL);
+    slab_runs[objsize / ALIGNMENT - 1] = run;
+    return run;
+}
+
+/*
+ * carve_run - Allocate the first aligned run block in free block bp,
+ *     giving back the free space before it and after it, unless what
+ *     follows is too small for a free block and stays in the run block.
+ *     Return the run, NULL if bp has no room for one
+ */
+static void *carve_run(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    char *run = heap_base + (RUN_INDEX((char *)bp - 1) + 1) * RUN_SIZE;
+    size_t front, back;
+
+    if (run != bp && run - (char *)bp < 2 * DSIZE) run += RUN_SIZE;
+    front = run - (char *)bp;
+    if (front + RUN_SIZE > size) return NULL;
+    back = size - front - RUN_SIZE;
+    if (back < 2 * DSIZE) back = 0;
+
+    delete_node(bp);
+    if (front > 0) {
+        PUT(HDRP(bp), PACK(front, 0) | PREV_ALLOC);
+        PUT(FTRP(bp), PACK(front, 0));
+        insert_node(bp, front);
     }
+    PUT(HDRP(run), PACK(size - front - back, 1) | (front > 0 ? 0 : PREV_ALLOC));
+    if (back > 0) {
+        PUT(HDRP(NEXT_BLKP(run)), PACK(back, 0) | PREV_ALLOC);
+        PUT(FTRP(NEXT_BLKP(run)), PACK(back, 0));
+        insert_node(NEXT_BLKP(run), back);
+    } else {
+        SET_PREV_ALLOC(NEXT_BLKP(run));
+    }
+    return run;
+}
+
+/*
+ * mapping - Compute the TLSF class [fl][sl] of a block of size bytes
+ */
+static void mapping(size_t size, int *fl, int *sl) {
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size >> 3;
+    } else {
+        int msb = FLS(size);
+        *fl = msb - FL_SHIFT + 1;
+        *sl = (size >> (msb - SL_LOG2)) - SL_COUNT;
+    }
+}
+
+/*
+ * insert_node - Push free block bp on the front of its class list, O(1)
+ */
+static void insert_node(void *bp, size_t size) {
+    int fl, sl;
+    mapping(size, &fl, &sl);
+    char *head = seg_free_lists[fl][sl];
+
+    SET_PTR(PRED_PTR(bp), NULL);
+    SET_PTR(SUCC_PTR(bp), head);
+    if (head != NULL) SET_PTR(PRED_PTR(head), bp);
+    seg_free_lists[fl][sl] = bp;
+    fl_bitmap |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+}
+
+/*
+ * delete_node - Unlink free block bp from its class list, O(1)
+ */
+static void delete_node(void *bp) {
+    int fl, sl;
+    mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
 
     if (PRED(bp) == NULL) {  // first one
-        seg_free_lists[tar] = SUCC(bp);
-        if (SUCC(bp) != NULL) SET_PTR(PRED_PTR(SUCC(bp)), NULL);
+        seg_free_lists[fl][sl] = SUCC(bp);
+        if (SUCC(bp) != NULL) {
+            SET_PTR(PRED_PTR(SUCC(bp)), NULL);
+        } else {  // list is empty now
+            sl_bitmap[fl] &= ~(1u << sl);
+            if (sl_bitmap[fl] == 0) fl_bitmap &= ~(1u << fl);
+        }
     } else if (SUCC(bp) == NULL) {  // last one
         SET_PTR(SUCC_PTR(PRED(bp)), NULL);
     } else {
@@ -523,18 +822,24 @@ static void delete_node(void *bp) {
  * find_fit - Find a fit for a block with asize bytes
  */
 static void *find_fit(size_t asize) {
-    /* Next fit search */
-    char *oldrover = rover;
-
-    /* Search from the rover to the end of list */
-    for (; GET_SIZE(HDRP(rover)) > 0; rover = NEXT_BLKP(rover))
-        if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
-            return rover;
-
-    /* search from start of list to old rover */
-    for (rover = heap_listp; rover < oldrover; rover = NEXT_BLKP(rover))
-        if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
-            return rover;
+    int fl, sl;
+    unsigned int map;
+    char *bp;
 
-    return NULL; /* no fit found */
-}
\ No newline at end of file
+    /* The head of the class of asize itself may be big enough. Scanning
+     * the rest of it costs more than it saves: small leftovers pile up */
+    mapping(asize, &fl, &sl);
+    bp = seg_free_lists[fl][sl];
+    if (bp != NULL && GET_SIZE(HDRP(bp)) >= asize) return bp;
+
+    /* Any block of a larger class fits: take the smallest non-empty one */
+    map = sl < SL_COUNT - 1 ? sl_bitmap[fl] & (~0u << (sl + 1)) : 0;
+    if (map == 0) {
+        map = fl < FL_COUNT - 1 ? fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (map == 0) return NULL; /* no fit found */
+        fl = __builtin_ctz(map);
+        map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(map);
+    return seg_free_lists[fl][sl];
+}